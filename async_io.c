@@ -0,0 +1,611 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/** A buffer of the pipeline and the chunk of input it holds.
+  *
+  * `len` bytes have been read into `buf`, of which `done` have been written out. `offset`
+  * is where the chunk starts in the input and, after `out_base`, in the output.
+  */
+struct async_slot {
+    uint8_t *buf;
+    size_t len;
+    size_t want;
+    size_t done;
+    uint64_t seq;
+    off_t offset;
+    int state;
+};
+
+enum {
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READ,
+    SLOT_TRANSFORMED,
+    SLOT_WRITING
+};
+
+/** The shared state of one `cipher_async_fd` call.
+  */
+struct async_pipeline {
+    struct cipher_stream *stream;
+    int in_fd;
+    int out_fd;
+    struct async_slot *slots;
+    int depth;
+    size_t buffer_size;
+    int in_seekable;
+    int out_seekable;
+    off_t in_base;
+    off_t in_size;
+    off_t out_base;
+    uint64_t bytes;
+    int error;
+};
+
+/** Work out whether reads and writes can be issued at explicit offsets (so that several
+  * may be in flight at once) or must happen one at a time at the file position.
+  */
+static void probe_files(struct async_pipeline *ap) {
+    struct stat st;
+
+    ap->in_base = lseek(ap->in_fd, 0, SEEK_CUR);
+    ap->in_seekable = fstat(ap->in_fd, &st) == 0 && S_ISREG(st.st_mode) && ap->in_base >= 0;
+    ap->in_size = ap->in_seekable ? st.st_size : 0;
+
+    /* With O_APPEND every write goes to the end whatever its offset, so completions out
+     * of order would reorder the output. */
+    int flags = fcntl(ap->out_fd, F_GETFL);
+    ap->out_base = lseek(ap->out_fd, 0, SEEK_CUR);
+    ap->out_seekable = fstat(ap->out_fd, &st) == 0 && S_ISREG(st.st_mode)
+                       && ap->out_base >= 0 && flags >= 0 && !(flags & O_APPEND);
+}
+
+/** Leave the file positions where a synchronous copy would have left them.
+  */
+static void finish_files(struct async_pipeline *ap) {
+    if (ap->in_seekable) {
+        lseek(ap->in_fd, ap->in_base + (off_t) ap->bytes, SEEK_SET);
+    }
+    if (ap->out_seekable) {
+        lseek(ap->out_fd, ap->out_base + (off_t) ap->bytes, SEEK_SET);
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+/** A submission and completion queue pair, mapped from the kernel.
+  */
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    unsigned to_submit;
+};
+
+static void uring_close(struct uring *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+    close(ring->fd);
+}
+
+/** Create a ring of at least `entries` entries and register `num_bufs` buffers of
+  * `buf_len` bytes with it.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int uring_open(struct uring *ring, unsigned entries, struct async_slot *slots,
+                      int num_bufs, size_t buf_len) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_len = ring->sq_ring_len > ring->cq_ring_len ? ring->sq_ring_len : ring->cq_ring_len;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /* Registered buffers are pinned once, rather than on every read and write. */
+    struct iovec iov[CIPHER_ASYNC_MAX_DEPTH];
+    for (int i = 0; i < num_bufs; ++i) {
+        iov[i].iov_base = slots[i].buf;
+        iov[i].iov_len = buf_len;
+    }
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, num_bufs) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:;
+    int saved_errno = errno;
+    uring_close(ring);
+    errno = saved_errno;
+    return -1;
+}
+
+/** Queue a fixed-buffer read or write of slot `index`. The ring always has room, since
+  * it has an entry for every slot and each slot has at most one operation in flight.
+  */
+static void uring_queue(struct uring *ring, int opcode, int fd, struct async_slot *slot,
+                        int index, uint8_t *buf, size_t len, off_t offset) {
+    unsigned tail = *ring->sq_tail;
+    unsigned i = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t) opcode;
+    sqe->fd = fd;
+    sqe->off = (uint64_t) offset;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->buf_index = (uint16_t) index;
+    sqe->user_data = (uint64_t) index;
+    ring->sq_array[i] = i;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    slot->state = opcode == IORING_OP_READ_FIXED ? SLOT_READING : SLOT_WRITING;
+}
+
+/** Queue the next read into `slot`, or return 0 if the input is exhausted.
+  */
+static int queue_read(struct async_pipeline *ap, struct uring *ring, int index,
+                      off_t *next_offset, uint64_t *next_seq, int *eof) {
+    struct async_slot *slot = &ap->slots[index];
+
+    if (*eof || (ap->in_seekable && *next_offset >= ap->in_size)) {
+        *eof = 1;
+        return 0;
+    }
+    slot->len = 0;
+    slot->done = 0;
+    slot->seq = (*next_seq)++;
+    slot->offset = *next_offset;
+    slot->want = ap->buffer_size;
+    if (ap->in_seekable) {
+        off_t left = ap->in_size - *next_offset;
+        slot->want = left < (off_t) ap->buffer_size ? (size_t) left : ap->buffer_size;
+        *next_offset += (off_t) slot->want;
+    }
+    /* An offset of -1 reads from the file position, for pipes and terminals. */
+    uring_queue(ring, IORING_OP_READ_FIXED, ap->in_fd, slot, index, slot->buf, slot->want,
+                ap->in_seekable ? ap->in_base + slot->offset : (off_t) -1);
+    return 1;
+}
+
+static void queue_write(struct async_pipeline *ap, struct uring *ring, int index) {
+    struct async_slot *slot = &ap->slots[index];
+    uring_queue(ring, IORING_OP_WRITE_FIXED, ap->out_fd, slot, index, slot->buf + slot->done,
+                slot->len - slot->done,
+                ap->out_seekable ? ap->out_base + slot->offset + (off_t) slot->done
+                                 : (off_t) -1);
+}
+
+/** Run the pipeline on io_uring.
+  *
+  * Reads are issued into every free buffer (all at once for a regular file, one at a time
+  * otherwise), chunks are transformed strictly in input order as their reads complete,
+  * and writes go out as soon as a chunk is transformed (again one at a time unless the
+  * output is a regular file).
+  *
+  * \return 0 on success, -1 on failure (with `errno` set), or 1 if io_uring is unavailable
+  */
+static int run_uring(struct async_pipeline *ap) {
+    struct uring ring;
+    if (uring_open(&ring, (unsigned) ap->depth, ap->slots, ap->depth,
+                   ap->buffer_size) != 0) {
+        TRACE(1, "io_uring unavailable: %s\n", strerror(errno));
+        return 1;
+    }
+
+    off_t next_offset = 0;
+    uint64_t next_seq = 0;
+    uint64_t next_transform = 0;
+    uint64_t next_write = 0;
+    int eof = 0;
+    int in_flight = 0;
+    int reading = 0;
+    int writing = 0;
+
+    for (;;) {
+        for (int i = 0; i < ap->depth && ap->error == 0; ++i) {
+            struct async_slot *slot = &ap->slots[i];
+            if (slot->state == SLOT_FREE && (ap->in_seekable || reading == 0)
+                && queue_read(ap, &ring, i, &next_offset, &next_seq, &eof)) {
+                in_flight++;
+                reading++;
+            }
+        }
+
+        /* Transform in input order, however the reads completed. */
+        for (int progress = 1; progress && ap->error == 0;) {
+            progress = 0;
+            for (int i = 0; i < ap->depth; ++i) {
+                struct async_slot *slot = &ap->slots[i];
+                if (slot->state == SLOT_READ && slot->seq == next_transform) {
+                    if (!ap->in_seekable) {
+                        slot->offset = (off_t) ap->bytes;
+                    }
+                    cipher_stream_update(ap->stream, slot->buf, slot->len, slot->buf);
+                    ap->bytes += slot->len;
+                    slot->state = SLOT_TRANSFORMED;
+                    next_transform++;
+                    progress = 1;
+                }
+            }
+        }
+        for (int i = 0; i < ap->depth && ap->error == 0; ++i) {
+            struct async_slot *slot = &ap->slots[i];
+            if (slot->state == SLOT_TRANSFORMED && (ap->out_seekable
+                                                    || (writing == 0 && slot->seq == next_write))) {
+                queue_write(ap, &ring, i);
+                in_flight++;
+                writing++;
+            }
+        }
+
+        if (in_flight == 0) {
+            break;
+        }
+        int entered = (int) syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, 1,
+                                    IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* The queued entries are lost with the ring, so nothing is left in flight. */
+            ap->error = errno;
+            break;
+        }
+        ring.to_submit -= (unsigned) entered;
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            int index = (int) cqe->user_data;
+            struct async_slot *slot = &ap->slots[index];
+            in_flight--;
+            if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                ap->error = ap->error != 0 ? ap->error : -cqe->res;
+                reading -= slot->state == SLOT_READING;
+                writing -= slot->state == SLOT_WRITING;
+                slot->state = SLOT_FREE;
+                continue;
+            }
+            size_t n = cqe->res > 0 ? (size_t) cqe->res : 0;
+            if (slot->state == SLOT_READING) {
+                slot->len += n;
+                if (cqe->res == 0 && ap->in_seekable && slot->len < slot->want) {
+                    ap->error = ap->error != 0 ? ap->error : EIO;
+                }
+                if (ap->error != 0 || (!ap->in_seekable && cqe->res == 0)) {
+                    eof |= cqe->res == 0;
+                    reading--;
+                    slot->state = SLOT_FREE;
+                } else if (slot->len < slot->want && (ap->in_seekable || cqe->res < 0)) {
+                    uring_queue(&ring, IORING_OP_READ_FIXED, ap->in_fd, slot, index,
+                                slot->buf + slot->len, slot->want - slot->len,
+                                ap->in_seekable ? ap->in_base + slot->offset + (off_t) slot->len
+                                                : (off_t) -1);
+                    in_flight++;
+                } else {
+                    reading--;
+                    slot->state = SLOT_READ;
+                }
+            } else {
+                slot->done += n;
+                if (slot->done < slot->len && ap->error == 0) {
+                    queue_write(ap, &ring, index);
+                    in_flight++;
+                } else {
+                    writing--;
+                    next_write += !ap->out_seekable;
+                    slot->state = SLOT_FREE;
+                }
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_close(&ring);
+    if (ap->error != 0) {
+        errno = ap->error;
+        return -1;
+    }
+    return 0;
+}
+
+#endif
+
+/** A bounded queue of slot indices, used by the thread-based pipeline.
+  */
+struct slot_queue {
+    int items[CIPHER_ASYNC_MAX_DEPTH];
+    int head;
+    int count;
+};
+
+/** The shared state of the thread-based pipeline: a reader thread fills free buffers, the
+  * calling thread transforms them, and a writer thread drains them back to the free
+  * queue. A slot with `len` 0 marks the end of the input.
+  */
+struct thread_pipeline {
+    struct async_pipeline *ap;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct slot_queue free;
+    struct slot_queue filled;
+    struct slot_queue transformed;
+    int failed;
+};
+
+static void queue_push(struct thread_pipeline *tp, struct slot_queue *queue, int slot) {
+    pthread_mutex_lock(&tp->lock);
+    queue->items[(queue->head + queue->count++) % CIPHER_ASYNC_MAX_DEPTH] = slot;
+    pthread_cond_broadcast(&tp->changed);
+    pthread_mutex_unlock(&tp->lock);
+}
+
+static int queue_pop(struct thread_pipeline *tp, struct slot_queue *queue) {
+    pthread_mutex_lock(&tp->lock);
+    while (queue->count == 0) {
+        pthread_cond_wait(&tp->changed, &tp->lock);
+    }
+    int slot = queue->items[queue->head];
+    queue->head = (queue->head + 1) % CIPHER_ASYNC_MAX_DEPTH;
+    queue->count--;
+    pthread_mutex_unlock(&tp->lock);
+    return slot;
+}
+
+static void fail_pipeline(struct thread_pipeline *tp, int error) {
+    pthread_mutex_lock(&tp->lock);
+    if (tp->ap->error == 0) {
+        tp->ap->error = error;
+    }
+    tp->failed = 1;
+    pthread_mutex_unlock(&tp->lock);
+}
+
+static void read_stage(struct thread_pipeline *tp) {
+    struct async_pipeline *ap = tp->ap;
+
+    for (;;) {
+        int index = queue_pop(tp, &tp->free);
+        struct async_slot *slot = &ap->slots[index];
+        slot->len = 0;
+        while (!__atomic_load_n(&tp->failed, __ATOMIC_RELAXED)) {
+            ssize_t n = read(ap->in_fd, slot->buf, ap->buffer_size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                fail_pipeline(tp, errno);
+            }
+            slot->len = n > 0 ? (size_t) n : 0;
+            break;
+        }
+        size_t len = slot->len;
+        queue_push(tp, &tp->filled, index);
+        if (len == 0) {
+            return;
+        }
+    }
+}
+
+static void write_stage(struct thread_pipeline *tp) {
+    struct async_pipeline *ap = tp->ap;
+
+    for (;;) {
+        int index = queue_pop(tp, &tp->transformed);
+        struct async_slot *slot = &ap->slots[index];
+        if (slot->len == 0) {
+            return;
+        }
+        /* After a failure, keep draining so that the other stages never block. */
+        for (size_t done = 0; done < slot->len && !__atomic_load_n(&tp->failed, __ATOMIC_RELAXED);) {
+            ssize_t n = write(ap->out_fd, slot->buf + done, slot->len - done);
+            if (n < 0 && errno != EINTR) {
+                fail_pipeline(tp, errno);
+            }
+            done += n > 0 ? (size_t) n : 0;
+        }
+        queue_push(tp, &tp->free, index);
+    }
+}
+
+static void pipeline_task(void *arg, int index) {
+    struct thread_pipeline *tp = arg;
+
+    if (index == 1) {
+        read_stage(tp);
+    } else if (index == 2) {
+        write_stage(tp);
+    } else {
+        for (;;) {
+            int slot_index = queue_pop(tp, &tp->filled);
+            struct async_slot *slot = &tp->ap->slots[slot_index];
+            /* Once the slot is handed on it may be refilled, so look at it first. */
+            size_t len = slot->len;
+            if (len > 0 && !__atomic_load_n(&tp->failed, __ATOMIC_RELAXED)) {
+                cipher_stream_update(tp->ap->stream, slot->buf, len, slot->buf);
+                tp->ap->bytes += len;
+            }
+            queue_push(tp, &tp->transformed, slot_index);
+            if (len == 0) {
+                return;
+            }
+        }
+    }
+}
+
+/** Run the pipeline on a reader thread, the calling thread and a writer thread.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int run_threads(struct async_pipeline *ap) {
+    struct thread_pipeline tp;
+
+    memset(&tp, 0, sizeof(tp));
+    tp.ap = ap;
+    pthread_mutex_init(&tp.lock, NULL);
+    pthread_cond_init(&tp.changed, NULL);
+    for (int i = 0; i < ap->depth; ++i) {
+        tp.free.items[tp.free.count++] = i;
+    }
+    run_parallel(3, pipeline_task, &tp);
+    pthread_mutex_destroy(&tp.lock);
+    pthread_cond_destroy(&tp.changed);
+    if (ap->error != 0) {
+        errno = ap->error;
+        return -1;
+    }
+    return 0;
+}
+
+int cipher_async_fd(struct cipher_stream *stream, int in_fd, int out_fd, int queue_depth,
+                    enum async_backend backend, struct cipher_async_stats *stats) {
+    struct async_pipeline ap;
+    struct timespec start;
+    struct timespec end;
+
+    if (queue_depth < 2 || queue_depth > CIPHER_ASYNC_MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&ap, 0, sizeof(ap));
+    ap.stream = stream;
+    ap.in_fd = in_fd;
+    ap.out_fd = out_fd;
+    ap.depth = queue_depth;
+    ap.buffer_size = (size_t) CIPHER_STREAM_CHUNK
+                     * (stream->multi == NULL && stream->num_threads > 1 ? stream->num_threads : 1);
+    ap.slots = calloc(queue_depth, sizeof(*ap.slots));
+    if (ap.slots == NULL) {
+        return -1;
+    }
+    int result = 0;
+    for (int i = 0; i < queue_depth && result == 0; ++i) {
+        ap.slots[i].buf = malloc(ap.buffer_size);
+        result = ap.slots[i].buf == NULL ? -1 : 0;
+    }
+    probe_files(&ap);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int used_io_uring = 0;
+#ifdef HAVE_IO_URING
+    if (result == 0 && backend != ASYNC_THREADS) {
+        result = run_uring(&ap);
+        used_io_uring = result != 1;
+        if (result == 1 && backend == ASYNC_IO_URING) {
+            result = -1;
+        } else if (result == 1) {
+            result = run_threads(&ap);
+        }
+    } else if (result == 0) {
+        result = run_threads(&ap);
+    }
+#else
+    if (result == 0 && backend == ASYNC_IO_URING) {
+        errno = ENOSYS;
+        result = -1;
+    } else if (result == 0) {
+        result = run_threads(&ap);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    finish_files(&ap);
+
+    if (stats != NULL) {
+        stats->bytes = ap.bytes;
+        stats->seconds = (double) (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        stats->used_io_uring = used_io_uring;
+    }
+
+    int saved_errno = errno;
+    for (int i = 0; i < queue_depth; ++i) {
+        free(ap.slots[i].buf);
+    }
+    free(ap.slots);
+    errno = saved_errno;
+    return result;
+}
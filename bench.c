@@ -0,0 +1,568 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+/** Upper bound on the number of values accepted by each list-valued option.
+  */
+#define BENCH_MAX_LIST 32
+
+/** Implementations that can be benchmarked against each other.
+  */
+enum bench_variant {
+    VARIANT_SCALAR,     /* *_buf functions, SIMD disabled */
+    VARIANT_SIMD,       /* *_buf functions, widest SIMD kernels */
+    VARIANT_TABLE,      /* cipher_ctx_apply, SIMD disabled */
+    VARIANT_CTX,        /* cipher_ctx_apply, widest SIMD kernels */
+    VARIANT_THREADED,   /* cipher_ctx_apply_parallel */
+    VARIANT_SPARSE,     /* cipher_ctx_apply in sparse mode */
+    NUM_VARIANTS
+};
+
+static const char *const variant_names[NUM_VARIANTS] = {
+    "scalar", "simd", "table", "ctx", "threaded", "sparse"
+};
+
+/** Kinds of generated input.
+  */
+enum bench_density {
+    DENSITY_LETTERS,    /* every byte in range */
+    DENSITY_MIXED,      /* mostly in range, with spaces, digits and punctuation */
+    DENSITY_BINARY,     /* uniformly random bytes */
+    DENSITY_UTF8,       /* three-byte UTF-8 characters, with the odd in-range word */
+    NUM_DENSITIES
+};
+
+static const char *const density_names[NUM_DENSITIES] = {
+    "letters", "mixed", "binary", "utf8"
+};
+
+static const char *const op_names[] = {
+    "caesar_encrypt", "caesar_decrypt", "vigenere_encrypt", "vigenere_decrypt"
+};
+
+/** Settings for a benchmark run, as given on the command line.
+  */
+struct bench_options {
+    size_t sizes[BENCH_MAX_LIST];
+    int num_sizes;
+    size_t key_lens[BENCH_MAX_LIST];
+    int num_key_lens;
+    char ranges[BENCH_MAX_LIST][2];
+    int num_ranges;
+    int densities[BENCH_MAX_LIST];
+    int num_densities;
+    int variants[BENCH_MAX_LIST];
+    int num_variants;
+    int warmup;
+    int reps;
+    double min_time;
+    int num_threads;
+    int json;
+};
+
+/** Timing results for one configuration.
+  */
+struct bench_result {
+    double median;      /* bytes per second */
+    double mean;
+    double min;
+    double max;
+    double stddev;
+    double cycles_per_byte;
+    long iters;
+};
+
+/** Return the current monotonic time in seconds.
+  */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Return a timestamp counter reading, or 0 where none is available.
+  */
+static uint64_t cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/** Deterministic xorshift generator, so every run benchmarks the same data.
+  */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/** Fill `buf` with UTF-8 text of three-byte characters, as in Chinese or Japanese, with
+  * a word of up to 8 in-range characters about every 100 characters.
+  */
+static void fill_utf8(uint8_t *buf, size_t len, uint8_t low, int range_size,
+                      uint64_t *state) {
+    size_t i = 0;
+    while (i < len) {
+        uint64_t r = next_random(state);
+        if (r % 100 == 0) {
+            for (int n = 1 + (int) ((r >> 8) % 8); n > 0 && i < len; --n) {
+                buf[i++] = (uint8_t) (low + next_random(state) % range_size);
+            }
+            continue;
+        }
+        uint8_t ch[3] = {
+            (uint8_t) (0xe4 + (r >> 8) % 6), (uint8_t) (0x80 + (r >> 16) % 64),
+            (uint8_t) (0x80 + (r >> 24) % 64)
+        };
+        for (int n = 0; n < 3 && i < len; ++n) {
+            buf[i++] = ch[n];
+        }
+    }
+}
+
+static void fill_input(uint8_t *buf, size_t len, enum bench_density density,
+                       uint8_t low, uint8_t high) {
+    static const char filler[] = " ,.;:!?'-0123456789\n";
+    uint64_t state = 0x9e3779b97f4a7c15u;
+    int range_size = high - low + 1;
+
+    if (density == DENSITY_UTF8) {
+        fill_utf8(buf, len, low, range_size, &state);
+        return;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t r = next_random(&state);
+        switch (density) {
+        case DENSITY_LETTERS:
+            buf[i] = (uint8_t) (low + r % range_size);
+            break;
+        case DENSITY_MIXED:
+            if (r % 5 == 0) {
+                buf[i] = (uint8_t) filler[(r >> 8) % (sizeof(filler) - 1)];
+            } else {
+                buf[i] = (uint8_t) (low + (r >> 8) % range_size);
+            }
+            break;
+        default:
+            buf[i] = (uint8_t) r;
+            break;
+        }
+    }
+}
+
+/** Run one call of the function being benchmarked.
+  */
+static void run_once(enum bench_variant variant, enum cipher_op op,
+                     const struct cipher_ctx *ctx, const char range[2],
+                     int shift, const uint8_t *key, size_t key_len,
+                     const uint8_t *in, size_t len, uint8_t *out, int num_threads) {
+    switch (variant) {
+    case VARIANT_SCALAR:
+    case VARIANT_SIMD:
+        switch (op) {
+        case CAESAR_ENCRYPT:
+            caesar_encrypt_buf(range[0], range[1], shift, in, len, out);
+            break;
+        case CAESAR_DECRYPT:
+            caesar_decrypt_buf(range[0], range[1], shift, in, len, out);
+            break;
+        case VIGENERE_ENCRYPT:
+            vigenere_encrypt_buf(range[0], range[1], key, key_len, 0, in, len, out);
+            break;
+        case VIGENERE_DECRYPT:
+            vigenere_decrypt_buf(range[0], range[1], key, key_len, 0, in, len, out);
+            break;
+        }
+        break;
+    case VARIANT_TABLE:
+    case VARIANT_CTX:
+    case VARIANT_SPARSE:
+        cipher_ctx_apply(ctx, 0, in, len, out);
+        break;
+    default:
+        cipher_ctx_apply_parallel(ctx, 0, in, len, out, num_threads);
+        break;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/** Time one configuration: calibrate the number of calls per repetition during warmup
+  * so that each repetition lasts at least `min_time`, then time `reps` repetitions.
+  */
+static void bench_config(const struct bench_options *opts, enum bench_variant variant,
+                         enum cipher_op op, const struct cipher_ctx *ctx,
+                         const char range[2], int shift, const uint8_t *key,
+                         size_t key_len, const uint8_t *in, size_t len, uint8_t *out,
+                         struct bench_result *result) {
+    long iters = 1;
+    double *rates = malloc(sizeof(double) * opts->reps);
+    uint64_t total_cycles = 0;
+
+    for (int w = 0; w < opts->warmup || w == 0; ++w) {
+        for (;;) {
+            double start = now();
+            for (long n = 0; n < iters; ++n) {
+                run_once(variant, op, ctx, range, shift, key, key_len, in, len, out,
+                         opts->num_threads);
+            }
+            double elapsed = now() - start;
+            if (elapsed >= opts->min_time || iters >= (1L << 40)) {
+                break;
+            }
+            iters = elapsed > 0 ? (long) (iters * (opts->min_time / elapsed) * 1.2) + 1 : iters * 10;
+        }
+    }
+
+    for (int r = 0; r < opts->reps; ++r) {
+        uint64_t start_cycles = cycles();
+        double start = now();
+        for (long n = 0; n < iters; ++n) {
+            run_once(variant, op, ctx, range, shift, key, key_len, in, len, out,
+                     opts->num_threads);
+        }
+        double elapsed = now() - start;
+        total_cycles += cycles() - start_cycles;
+        rates[r] = (double) len * iters / (elapsed > 0 ? elapsed : 1e-9);
+    }
+
+    double sum = 0;
+    double sum_sq = 0;
+    for (int r = 0; r < opts->reps; ++r) {
+        sum += rates[r];
+        sum_sq += rates[r] * rates[r];
+    }
+    qsort(rates, opts->reps, sizeof(double), compare_doubles);
+    result->iters = iters;
+    result->min = rates[0];
+    result->max = rates[opts->reps - 1];
+    result->median = opts->reps % 2 ? rates[opts->reps / 2]
+                                    : (rates[opts->reps / 2 - 1] + rates[opts->reps / 2]) / 2;
+    result->mean = sum / opts->reps;
+    double variance = sum_sq / opts->reps - result->mean * result->mean;
+    result->stddev = variance > 0 ? sqrt(variance) : 0;
+    result->cycles_per_byte = (double) total_cycles / ((double) len * iters * opts->reps);
+    free(rates);
+}
+
+/** Parse a size such as `4096`, `64K`, `1M` or `1G`.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int parse_size(const char *text, size_t *size) {
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    switch (*end) {
+    case 'K': case 'k': n <<= 10; ++end; break;
+    case 'M': case 'm': n <<= 20; ++end; break;
+    case 'G': case 'g': n <<= 30; ++end; break;
+    default: break;
+    }
+    if (end == text || *end != '\0' || n == 0) {
+        return 1;
+    }
+    *size = (size_t) n;
+    return 0;
+}
+
+/** Split a comma-separated list, calling `parse` on each item.
+  *
+  * \return The number of items, or -1 if there are too many or one fails to parse
+  */
+static int parse_list(const char *text, int (*parse)(const char *, void *, int),
+                      void *dest) {
+    char item[64];
+    int count = 0;
+
+    while (*text != '\0') {
+        size_t n = strcspn(text, ",");
+        if (n >= sizeof(item) || count >= BENCH_MAX_LIST) {
+            return -1;
+        }
+        memcpy(item, text, n);
+        item[n] = '\0';
+        if (parse(item, dest, count) != 0) {
+            return -1;
+        }
+        ++count;
+        text += n + (text[n] == ',');
+    }
+    return count;
+}
+
+static int parse_size_item(const char *item, void *dest, int index) {
+    return parse_size(item, &((size_t *) dest)[index]);
+}
+
+static int parse_range_item(const char *item, void *dest, int index) {
+    char (*ranges)[2] = dest;
+    if (strlen(item) != 3 || item[1] != '-' || (uint8_t) item[2] <= (uint8_t) item[0]) {
+        return 1;
+    }
+    ranges[index][0] = item[0];
+    ranges[index][1] = item[2];
+    return 0;
+}
+
+static int parse_name_item(const char *item, const char *const *names, int num_names,
+                           int *dest) {
+    for (int i = 0; i < num_names; ++i) {
+        if (strcmp(item, names[i]) == 0) {
+            *dest = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parse_density_item(const char *item, void *dest, int index) {
+    return parse_name_item(item, density_names, NUM_DENSITIES, &((int *) dest)[index]);
+}
+
+static int parse_variant_item(const char *item, void *dest, int index) {
+    return parse_name_item(item, variant_names, NUM_VARIANTS, &((int *) dest)[index]);
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "Usage: cli bench [options]\n"
+            "\n"
+            "Options (lists are comma-separated):\n"
+            "  --sizes LIST       input sizes, with optional K/M/G suffix (default 64,4K,64K,1M,64M)\n"
+            "  --key-lens LIST    Vigenere key lengths (default 1,8,64)\n"
+            "  --ranges LIST      character ranges as LOW-HIGH (default A-Z, ' '-'~')\n"
+            "  --density LIST     letters, mixed, binary or utf8 (default letters,mixed)\n"
+            "  --variants LIST    scalar, simd, table, ctx, threaded, sparse (default all)\n"
+            "  --warmup N         warmup repetitions (default 2)\n"
+            "  --reps N           timed repetitions (default 10)\n"
+            "  --min-time MS      minimum duration of each repetition (default 20)\n"
+            "  --threads N        threads for the threaded variant (default 4)\n"
+            "  --format FORMAT    csv or json (default csv)\n");
+}
+
+/** Parse the benchmark options, filling in defaults for those not given.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int parse_bench_options(int argc, char **argv, struct bench_options *opts) {
+    static const size_t default_sizes[] = { 64, 4 << 10, 64 << 10, 1 << 20, 64 << 20 };
+    static const size_t default_key_lens[] = { 1, 8, 64 };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->warmup = 2;
+    opts->reps = 10;
+    opts->min_time = 0.02;
+    opts->num_threads = 4;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int count = 0;
+        long n;
+        if (value == NULL) {
+            fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+            return 1;
+        }
+        ++i;
+        if (strcmp(arg, "--sizes") == 0) {
+            count = opts->num_sizes = parse_list(value, parse_size_item, opts->sizes);
+        } else if (strcmp(arg, "--key-lens") == 0) {
+            count = opts->num_key_lens = parse_list(value, parse_size_item, opts->key_lens);
+        } else if (strcmp(arg, "--ranges") == 0) {
+            count = opts->num_ranges = parse_list(value, parse_range_item, opts->ranges);
+        } else if (strcmp(arg, "--density") == 0) {
+            count = opts->num_densities = parse_list(value, parse_density_item, opts->densities);
+        } else if (strcmp(arg, "--variants") == 0) {
+            count = opts->num_variants = parse_list(value, parse_variant_item, opts->variants);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            if (parse_long_option(arg, value, 0, INT_MAX, &n) != 0) {
+                return 1;
+            }
+            opts->warmup = (int) n;
+            count = 1;
+        } else if (strcmp(arg, "--reps") == 0) {
+            if (parse_long_option(arg, value, 1, INT_MAX, &n) != 0) {
+                return 1;
+            }
+            opts->reps = (int) n;
+            count = 1;
+        } else if (strcmp(arg, "--min-time") == 0) {
+            char *endptr;
+            opts->min_time = strtod(value, &endptr) / 1000;
+            count = *value != '\0' && *endptr == '\0' && isfinite(opts->min_time)
+                    && opts->min_time > 0 ? 1 : -1;
+        } else if (strcmp(arg, "--threads") == 0) {
+            if (parse_long_option(arg, value, 1, CIPHER_MAX_THREADS, &n) != 0) {
+                return 1;
+            }
+            opts->num_threads = (int) n;
+            count = 1;
+        } else if (strcmp(arg, "--format") == 0) {
+            opts->json = strcmp(value, "json") == 0;
+            count = opts->json || strcmp(value, "csv") == 0 ? 1 : -1;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s.\n", arg);
+            return 1;
+        }
+        if (count <= 0) {
+            fprintf(stderr, "Error: Invalid value for %s.\n", arg);
+            return 1;
+        }
+    }
+
+    if (opts->num_sizes == 0) {
+        opts->num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+        memcpy(opts->sizes, default_sizes, sizeof(default_sizes));
+    }
+    if (opts->num_key_lens == 0) {
+        opts->num_key_lens = sizeof(default_key_lens) / sizeof(default_key_lens[0]);
+        memcpy(opts->key_lens, default_key_lens, sizeof(default_key_lens));
+    }
+    if (opts->num_ranges == 0) {
+        opts->ranges[0][0] = 'A';
+        opts->ranges[0][1] = 'Z';
+        opts->ranges[1][0] = ' ';
+        opts->ranges[1][1] = '~';
+        opts->num_ranges = 2;
+    }
+    if (opts->num_densities == 0) {
+        opts->densities[0] = DENSITY_LETTERS;
+        opts->densities[1] = DENSITY_MIXED;
+        opts->num_densities = 2;
+    }
+    if (opts->num_variants == 0) {
+        for (int v = 0; v < NUM_VARIANTS; ++v) {
+            opts->variants[v] = v;
+        }
+        opts->num_variants = NUM_VARIANTS;
+    }
+    return 0;
+}
+
+static void print_result(const struct bench_options *opts, int first, enum cipher_op op,
+                         enum bench_variant variant, const char range[2],
+                         enum bench_density density, size_t key_len, size_t size,
+                         const struct bench_result *r) {
+    if (opts->json) {
+        printf("%s  {\"function\": \"%s\", \"variant\": \"%s\", \"range_low\": %d, "
+               "\"range_high\": %d, \"density\": \"%s\", \"key_len\": %zu, \"size\": %zu, "
+               "\"iters\": %ld, \"reps\": %d, \"median_bps\": %.0f, \"mean_bps\": %.0f, "
+               "\"min_bps\": %.0f, \"max_bps\": %.0f, \"stddev_bps\": %.0f, "
+               "\"cycles_per_byte\": %.4f}",
+               first ? "" : ",\n", op_names[op], variant_names[variant],
+               (uint8_t) range[0], (uint8_t) range[1], density_names[density], key_len,
+               size, r->iters, opts->reps, r->median, r->mean, r->min, r->max, r->stddev,
+               r->cycles_per_byte);
+    } else {
+        printf("%s,%s,%d,%d,%s,%zu,%zu,%ld,%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.4f\n",
+               op_names[op], variant_names[variant], (uint8_t) range[0], (uint8_t) range[1],
+               density_names[density], key_len, size, r->iters, opts->reps, r->median,
+               r->mean, r->min, r->max, r->stddev, r->cycles_per_byte);
+    }
+    fflush(stdout);
+}
+
+int cli_bench(int argc, char **argv) {
+    struct bench_options opts;
+    if (parse_bench_options(argc, argv, &opts) != 0) {
+        bench_usage();
+        return 1;
+    }
+
+    size_t max_size = 0;
+    size_t max_key_len = 0;
+    for (int i = 0; i < opts.num_sizes; ++i) {
+        max_size = opts.sizes[i] > max_size ? opts.sizes[i] : max_size;
+    }
+    for (int i = 0; i < opts.num_key_lens; ++i) {
+        max_key_len = opts.key_lens[i] > max_key_len ? opts.key_lens[i] : max_key_len;
+    }
+    uint8_t *in = malloc(max_size);
+    uint8_t *out = malloc(max_size);
+    uint8_t *key = malloc(max_key_len);
+    if (in == NULL || out == NULL || key == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(in);
+        free(out);
+        free(key);
+        return 1;
+    }
+
+    if (opts.json) {
+        printf("[\n");
+    } else {
+        printf("function,variant,range_low,range_high,density,key_len,size,iters,reps,"
+               "median_bps,mean_bps,min_bps,max_bps,stddev_bps,cycles_per_byte\n");
+    }
+
+    enum simd_level best = simd_level();
+    int first = 1;
+    for (int ri = 0; ri < opts.num_ranges; ++ri) {
+        const char *range = opts.ranges[ri];
+        uint8_t low = (uint8_t) range[0];
+        uint8_t high = (uint8_t) range[1];
+        int shift = (high - low + 1) / 3;
+        uint64_t state = 12345;
+        for (size_t k = 0; k < max_key_len; ++k) {
+            key[k] = (uint8_t) (low + next_random(&state) % (high - low + 1));
+        }
+
+        for (int di = 0; di < opts.num_densities; ++di) {
+            enum bench_density density = opts.densities[di];
+            fill_input(in, max_size, density, low, high);
+
+            for (int op = CAESAR_ENCRYPT; op <= VIGENERE_DECRYPT; ++op) {
+                int vigenere = op == VIGENERE_ENCRYPT || op == VIGENERE_DECRYPT;
+                for (int ki = 0; ki < (vigenere ? opts.num_key_lens : 1); ++ki) {
+                    size_t key_len = vigenere ? opts.key_lens[ki] : 0;
+                    struct cipher_ctx ctx;
+                    if (cipher_ctx_init(&ctx, op, range[0], range[1], shift, key, key_len) != 0) {
+                        continue;
+                    }
+                    for (int vi = 0; vi < opts.num_variants; ++vi) {
+                        enum bench_variant variant = opts.variants[vi];
+                        int no_simd = variant == VARIANT_SCALAR || variant == VARIANT_TABLE;
+                        simd_set_level(no_simd ? SIMD_NONE : best);
+                        ctx.sparse = variant == VARIANT_SPARSE;
+                        for (int si = 0; si < opts.num_sizes; ++si) {
+                            struct bench_result result;
+                            bench_config(&opts, variant, op, &ctx, range, shift, key,
+                                         key_len, in, opts.sizes[si], out, &result);
+                            print_result(&opts, first, op, variant, range, density,
+                                         key_len, opts.sizes[si], &result);
+                            first = 0;
+                        }
+                    }
+                    cipher_ctx_free(&ctx);
+                }
+            }
+        }
+    }
+    simd_set_level(best);
+
+    if (opts.json) {
+        printf("\n]\n");
+    }
+    free(in);
+    free(out);
+    free(key);
+    return 0;
+}
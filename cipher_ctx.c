@@ -0,0 +1,202 @@
+#include "crypto.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Keys up to this length get a full 256-entry translation table per key position.
+  */
+#define VIGENERE_TABLE_KEY_LEN 64
+
+int cipher_ctx_init(struct cipher_ctx *ctx, enum cipher_op op, char range_low,
+                    char range_high, int shift, const uint8_t *key, size_t key_len) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->op = op;
+    ctx->low = (uint8_t) range_low;
+    ctx->high = (uint8_t) range_high;
+    if (ctx->high <= ctx->low) {
+        errno = EINVAL;
+        return -1;
+    }
+    ctx->range_size = ctx->high - ctx->low + 1;
+    TRACE(1, "compiling op %d for range %d..%d, key length %zu\n",
+          (int) op, ctx->low, ctx->high, key_len);
+
+    if (op == CAESAR_ENCRYPT || op == CAESAR_DECRYPT) {
+        shift %= ctx->range_size;
+        if (shift < 0) {
+            shift += ctx->range_size;
+        }
+        if (op == CAESAR_DECRYPT && shift != 0) {
+            shift = ctx->range_size - shift;
+        }
+        ctx->shift = shift;
+        for (int c = 0; c < 256; ++c) {
+            int in_range = c >= ctx->low && c <= ctx->high;
+            ctx->table[c] = (uint8_t) (in_range ? ctx->low + (c - ctx->low + shift) % ctx->range_size : c);
+        }
+        return 0;
+    }
+
+    if (key_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ctx->key_len = key_len;
+    ctx->shifts = malloc(VIGENERE_SCHEDULE_LEN(key_len));
+    if (ctx->shifts == NULL) {
+        return -1;
+    }
+    ctx->period = vigenere_schedule(range_low, range_high, key, key_len,
+                                    op == VIGENERE_DECRYPT, ctx->shifts);
+    for (int c = 0; c < 256; ++c) {
+        ctx->table[c] = c >= ctx->low && c <= ctx->high;
+    }
+
+    if (key_len <= VIGENERE_TABLE_KEY_LEN) {
+        ctx->key_tables = malloc(key_len * 256);
+        if (ctx->key_tables == NULL) {
+            cipher_ctx_free(ctx);
+            return -1;
+        }
+        for (size_t k = 0; k < key_len; ++k) {
+            uint8_t *row = ctx->key_tables + k * 256;
+            for (int c = 0; c < 256; ++c) {
+                row[c] = (uint8_t) (ctx->table[c] ? ctx->low + (c - ctx->low + ctx->shifts[k]) % ctx->range_size : c);
+            }
+        }
+    }
+    return 0;
+}
+
+void cipher_ctx_free(struct cipher_ctx *ctx) {
+    free(ctx->shifts);
+    free(ctx->key_tables);
+    ctx->shifts = NULL;
+    ctx->key_tables = NULL;
+}
+
+/** Transform every byte of `in` with the SIMD kernels and the tables.
+  */
+static size_t transform(const struct cipher_ctx *ctx, size_t key_index,
+                        const uint8_t *in, size_t len, uint8_t *out) {
+    const uint8_t *table = ctx->table;
+    size_t i;
+
+    if (ctx->op == CAESAR_ENCRYPT || ctx->op == CAESAR_DECRYPT) {
+        if (ctx->shift == 0) {
+            if (in != out) {
+                memcpy(out, in, len);
+            }
+            return key_index;
+        }
+        for (i = caesar_simd(ctx->low, ctx->range_size, ctx->shift, in, len, out); i < len; ++i) {
+            out[i] = table[in[i]];
+        }
+        return key_index;
+    }
+
+    size_t key_len = ctx->key_len;
+    size_t pos = key_index % key_len;
+    i = vigenere_simd(ctx->low, ctx->range_size, ctx->shifts, ctx->period, &pos, in, len, out);
+    key_index = pos % key_len;
+
+    if (ctx->key_tables != NULL) {
+        for (; i < len; ++i) {
+            uint8_t c = in[i];
+            out[i] = ctx->key_tables[key_index * 256 + c];
+            key_index += table[c];
+            key_index = key_index == key_len ? 0 : key_index;
+        }
+    } else {
+        for (; i < len; ++i) {
+            uint8_t c = in[i];
+            int t = c - ctx->low + ctx->shifts[key_index];
+            t -= t >= ctx->range_size ? ctx->range_size : 0;
+            out[i] = table[c] ? (uint8_t) (ctx->low + t) : c;
+            key_index += table[c];
+            key_index = key_index == key_len ? 0 : key_index;
+        }
+    }
+    return key_index;
+}
+
+/** Implementation of `cipher_ctx_apply`, without the metrics.
+  *
+  * In sparse mode the input alternates between runs of blocks with no in-range byte,
+  * which are copied and do not advance the key, and runs of blocks with some, which are
+  * transformed. Whatever the scan leaves unclassified (a partial block at the end, or
+  * everything on a CPU without SIMD support) is transformed as usual.
+  */
+static size_t ctx_apply(const struct cipher_ctx *ctx, size_t key_index,
+                        const uint8_t *in, size_t len, uint8_t *out) {
+    if (!ctx->sparse) {
+        return transform(ctx, key_index, in, len, out);
+    }
+
+    /* Reduce the key index as the plain path does, even if every block is skipped. */
+    key_index = transform(ctx, key_index, in, 0, out);
+    size_t i = 0;
+    while (i < len) {
+        size_t n = len - i < CIPHER_SCAN_SPAN ? len - i : CIPHER_SCAN_SPAN;
+        size_t idle = scan_blocks_simd(ctx->low, ctx->range_size, 0, in + i, n);
+        if (idle > 0 && in != out) {
+            memcpy(out + i, in + i, idle);
+        }
+        i += idle;
+        size_t busy = scan_blocks_simd(ctx->low, ctx->range_size, 1, in + i, n - idle);
+        busy = idle == 0 && busy == 0 ? n : busy;
+        key_index = transform(ctx, key_index, in + i, busy, out + i);
+        i += busy;
+    }
+    return key_index;
+}
+
+size_t cipher_ctx_apply(const struct cipher_ctx *ctx, size_t key_index,
+                        const uint8_t *in, size_t len, uint8_t *out) {
+    if (!metrics_enabled()) {
+        return ctx_apply(ctx, key_index, in, len, out);
+    }
+    uint64_t start = metrics_clock();
+    key_index = ctx_apply(ctx, key_index, in, len, out);
+    uint64_t elapsed = metrics_clock() - start;
+    metrics_record(ctx->op, len, count_in_range((char) ctx->low, (char) ctx->high, out, len),
+                   elapsed);
+    return key_index;
+}
+
+size_t cipher_ctx_apply_batch(const struct cipher_ctx *ctx, size_t key_index,
+                              const struct cipher_span *spans, size_t num_spans,
+                              int continue_key) {
+    size_t start = key_index;
+
+    for (size_t i = 0; i < num_spans; ++i) {
+        size_t end = cipher_ctx_apply(ctx, continue_key ? key_index : start, spans[i].in,
+                                      spans[i].len, spans[i].out);
+        key_index = continue_key ? end : start;
+    }
+    return key_index;
+}
+
+size_t cipher_ctx_apply_packed(const struct cipher_ctx *ctx, size_t key_index,
+                               const uint8_t *in, const size_t *offsets, size_t num_records,
+                               uint8_t *out, int continue_key) {
+    if (num_records == 0) {
+        return key_index;
+    }
+
+    /* Caesar has no per-record state, and a continuing key runs straight across record
+     * boundaries, so either way the records can be treated as one buffer. */
+    int caesar = ctx->op == CAESAR_ENCRYPT || ctx->op == CAESAR_DECRYPT;
+    if (caesar || continue_key) {
+        size_t first = offsets[0];
+        return cipher_ctx_apply(ctx, key_index, in + first, offsets[num_records] - first,
+                                out + first);
+    }
+
+    for (size_t i = 0; i < num_records; ++i) {
+        size_t first = offsets[i];
+        cipher_ctx_apply(ctx, key_index, in + first, offsets[i + 1] - first, out + first);
+    }
+    return key_index;
+}
@@ -0,0 +1,619 @@
+#include "crypto.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const double english_letter_frequencies[26] = {
+    8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966, 0.153, 0.772, 4.025, 2.406,
+    6.749, 7.507, 1.929, 0.095, 5.987, 6.327, 9.056, 2.758, 0.978, 2.360, 0.150, 1.974, 0.074
+};
+
+/** Inputs are not split across threads into pieces smaller than this.
+  */
+#define HISTOGRAM_MIN_CHUNK (1 << 20)
+
+/** Count the bytes of `in` into `hist`.
+  *
+  * Four interleaved sub-histograms are used so that runs of the same byte value do not
+  * serialise on a single counter.
+  */
+static void histogram_chunk(const uint8_t *in, size_t len, uint64_t hist[256]) {
+    uint32_t sub[4][256];
+    size_t i = 0;
+
+    while (i < len) {
+        /* Flush before the 32-bit counters can overflow. */
+        size_t end = len - i > ((size_t) 1 << 30) ? i + ((size_t) 1 << 30) : len;
+        memset(sub, 0, sizeof(sub));
+        for (; i + 4 <= end; i += 4) {
+            sub[0][in[i]]++;
+            sub[1][in[i + 1]]++;
+            sub[2][in[i + 2]]++;
+            sub[3][in[i + 3]]++;
+        }
+        for (; i < end; ++i) {
+            sub[0][in[i]]++;
+        }
+        for (int c = 0; c < 256; ++c) {
+            hist[c] += (uint64_t) sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+        }
+    }
+}
+
+/** One thread's share of a `byte_histogram` call.
+  */
+struct histogram_part {
+    const uint8_t *in;
+    size_t len;
+    uint64_t hist[256];
+};
+
+static void histogram_part(void *arg, int index) {
+    struct histogram_part *part = (struct histogram_part *) arg + index;
+    memset(part->hist, 0, sizeof(part->hist));
+    histogram_chunk(part->in, part->len, part->hist);
+}
+
+void byte_histogram(const uint8_t *in, size_t len, uint64_t hist[256], int num_threads) {
+    if (num_threads > CIPHER_MAX_THREADS) {
+        num_threads = CIPHER_MAX_THREADS;
+    }
+    if ((size_t) num_threads > len / HISTOGRAM_MIN_CHUNK) {
+        num_threads = (int) (len / HISTOGRAM_MIN_CHUNK);
+    }
+    if (num_threads <= 1) {
+        histogram_chunk(in, len, hist);
+        return;
+    }
+
+    struct histogram_part *parts = malloc(sizeof(*parts) * num_threads);
+    if (parts == NULL) {
+        histogram_chunk(in, len, hist);
+        return;
+    }
+    size_t part_len = len / num_threads;
+    for (int i = 0; i < num_threads; ++i) {
+        parts[i].in = in + i * part_len;
+        parts[i].len = i == num_threads - 1 ? len - i * part_len : part_len;
+    }
+    run_parallel(num_threads, histogram_part, parts);
+    for (int i = 0; i < num_threads; ++i) {
+        for (int c = 0; c < 256; ++c) {
+            hist[c] += parts[i].hist[c];
+        }
+    }
+    free(parts);
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const struct caesar_candidate *x = a;
+    const struct caesar_candidate *y = b;
+    if (x->chi_squared != y->chi_squared) {
+        return x->chi_squared < y->chi_squared ? -1 : 1;
+    }
+    return x->shift - y->shift;
+}
+
+int caesar_rank_shifts(char range_low, char range_high, const uint64_t hist[256],
+                       const double *reference, struct caesar_candidate *ranked) {
+    uint8_t low = (uint8_t) range_low;
+    int range_size = (uint8_t) range_high - low + 1;
+
+    if (range_size < 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reference == NULL) {
+        if (range_size != 26) {
+            errno = EINVAL;
+            return -1;
+        }
+        reference = english_letter_frequencies;
+    }
+
+    double ref_total = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < range_size; ++i) {
+        ref_total += reference[i];
+        total += hist[low + i];
+    }
+    if (ref_total <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Decrypting with shift s maps ciphertext position (p + s) % n back to plaintext
+     * position p, so the observed count of plaintext p is read straight from the
+     * ciphertext histogram without decrypting anything. Reference frequencies of zero are
+     * given a tiny expectation so that one stray character does not rule a shift out. */
+    for (int shift = 0; shift < range_size; ++shift) {
+        double chi_squared = 0;
+        for (int p = 0; p < range_size; ++p) {
+            double expected = total * reference[p] / ref_total;
+            double observed = (double) hist[low + (p + shift) % range_size];
+            if (expected < 1e-9) {
+                expected = 1e-9;
+            }
+            chi_squared += (observed - expected) * (observed - expected) / expected;
+        }
+        ranked[shift].shift = shift;
+        ranked[shift].chi_squared = chi_squared;
+    }
+    qsort(ranked, range_size, sizeof(*ranked), compare_candidates);
+    return 0;
+}
+
+size_t compact_in_range(char range_low, char range_high, const uint8_t *in, size_t len,
+                        uint8_t *out) {
+    uint8_t low = (uint8_t) range_low;
+    uint8_t last = (uint8_t) ((uint8_t) range_high - low);
+    size_t n = 0;
+
+    /* Every byte is stored, but the output position only advances past in-range ones. */
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t t = (uint8_t) (in[i] - low);
+        out[n] = t;
+        n += t <= last;
+    }
+    return n;
+}
+
+/** At most this many characters are sampled when estimating the index of coincidence of
+  * each candidate key length; the estimate is already very stable at this size.
+  */
+#define IOC_SAMPLE_LIMIT ((size_t) 1 << 22)
+
+/** Return the mean index of coincidence of the columns obtained by splitting `compact`
+  * into `key_len` interleaved columns.
+  */
+static double column_ioc(const uint8_t *compact, size_t n, size_t key_len, int range_size) {
+    uint32_t *hist = calloc(key_len * (size_t) range_size, sizeof(uint32_t));
+    if (hist == NULL) {
+        return 0;
+    }
+
+    size_t column = 0;
+    for (size_t i = 0; i < n; ++i) {
+        hist[column * range_size + compact[i]]++;
+        column = column + 1 == key_len ? 0 : column + 1;
+    }
+
+    double total = 0;
+    for (size_t col = 0; col < key_len; ++col) {
+        const uint32_t *h = hist + col * range_size;
+        double count = 0;
+        double pairs = 0;
+        for (int c = 0; c < range_size; ++c) {
+            count += h[c];
+            pairs += (double) h[c] * (h[c] - 1.0);
+        }
+        total += count > 1 ? pairs / (count * (count - 1)) : 0;
+    }
+    free(hist);
+    return total / key_len;
+}
+
+/** Shared state for computing the index of coincidence of many key lengths at once.
+  */
+struct ioc_job {
+    const uint8_t *compact;
+    size_t n;
+    int range_size;
+    size_t max_key_len;
+    int num_tasks;
+    struct vigenere_candidate *ranked;
+};
+
+static void ioc_task(void *arg, int index) {
+    struct ioc_job *job = arg;
+    for (size_t len = 1 + (size_t) index; len <= job->max_key_len; len += job->num_tasks) {
+        job->ranked[len - 1].key_len = len;
+        job->ranked[len - 1].ioc = column_ioc(job->compact, job->n, len, job->range_size);
+    }
+}
+
+static int compare_key_lengths(const void *a, const void *b) {
+    const struct vigenere_candidate *x = a;
+    const struct vigenere_candidate *y = b;
+    if (x->ioc != y->ioc) {
+        return x->ioc > y->ioc ? -1 : 1;
+    }
+    return x->key_len < y->key_len ? -1 : x->key_len > y->key_len;
+}
+
+void vigenere_rank_key_lengths(int range_size, const uint8_t *compact, size_t n,
+                               size_t max_key_len, int num_threads,
+                               struct vigenere_candidate *ranked) {
+    struct ioc_job job = {
+        .compact = compact,
+        .n = n < IOC_SAMPLE_LIMIT ? n : IOC_SAMPLE_LIMIT,
+        .range_size = range_size,
+        .max_key_len = max_key_len,
+        .num_tasks = num_threads < (int) max_key_len ? num_threads : (int) max_key_len,
+        .ranked = ranked,
+    };
+    if (job.num_tasks < 1) {
+        job.num_tasks = 1;
+    }
+    run_parallel(job.num_tasks, ioc_task, &job);
+    qsort(ranked, max_key_len, sizeof(*ranked), compare_key_lengths);
+
+    /* Every multiple of the true key length scores about as well as the length itself,
+     * so prefer the shortest length that comes close to the best score. */
+    size_t best = 0;
+    for (size_t i = 1; i < max_key_len; ++i) {
+        if (ranked[i].ioc >= 0.9 * ranked[0].ioc && ranked[i].key_len < ranked[best].key_len) {
+            best = i;
+        }
+    }
+    struct vigenere_candidate chosen = ranked[best];
+    memmove(ranked + 1, ranked, best * sizeof(*ranked));
+    ranked[0] = chosen;
+}
+
+/** One thread's share of the column histograms built by `vigenere_solve_key`.
+  */
+struct column_part {
+    const uint8_t *compact;
+    size_t start;
+    size_t end;
+    size_t key_len;
+    int range_size;
+    uint64_t *hist;
+};
+
+static void column_part(void *arg, int index) {
+    struct column_part *part = (struct column_part *) arg + index;
+    size_t column = part->start % part->key_len;
+    for (size_t i = part->start; i < part->end; ++i) {
+        part->hist[column * part->range_size + part->compact[i]]++;
+        column = column + 1 == part->key_len ? 0 : column + 1;
+    }
+}
+
+int vigenere_solve_key(char range_low, char range_high, const uint8_t *compact, size_t n,
+                       size_t key_len, const double *reference, int num_threads,
+                       uint8_t *key) {
+    uint8_t low = (uint8_t) range_low;
+    int range_size = (uint8_t) range_high - low + 1;
+    if (num_threads > CIPHER_MAX_THREADS) {
+        num_threads = CIPHER_MAX_THREADS;
+    }
+    if ((size_t) num_threads > n / HISTOGRAM_MIN_CHUNK) {
+        num_threads = n / HISTOGRAM_MIN_CHUNK > 0 ? (int) (n / HISTOGRAM_MIN_CHUNK) : 1;
+    }
+
+    size_t hist_len = key_len * (size_t) range_size;
+    struct column_part *parts = calloc(num_threads, sizeof(*parts));
+    uint64_t *hists = calloc(hist_len * num_threads, sizeof(uint64_t));
+    struct caesar_candidate *ranked = malloc(sizeof(*ranked) * range_size);
+    if (parts == NULL || hists == NULL || ranked == NULL) {
+        free(parts);
+        free(hists);
+        free(ranked);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        parts[i].compact = compact;
+        parts[i].start = n / num_threads * i;
+        parts[i].end = i == num_threads - 1 ? n : n / num_threads * (i + 1);
+        parts[i].key_len = key_len;
+        parts[i].range_size = range_size;
+        parts[i].hist = hists + hist_len * i;
+    }
+    run_parallel(num_threads, column_part, parts);
+
+    /* Each column is a Caesar cipher whose shift is the key character's offset. */
+    int result = 0;
+    for (size_t col = 0; col < key_len && result == 0; ++col) {
+        uint64_t hist[256] = {0};
+        for (int i = 0; i < num_threads; ++i) {
+            for (int c = 0; c < range_size; ++c) {
+                hist[low + c] += parts[i].hist[col * range_size + c];
+            }
+        }
+        result = caesar_rank_shifts(range_low, range_high, hist, reference, ranked);
+        key[col] = (uint8_t) (low + ranked[0].shift);
+    }
+
+    free(parts);
+    free(hists);
+    free(ranked);
+    return result;
+}
+
+/** Options shared by the cracking subcommands.
+  */
+struct crack_options {
+    const char *message;
+    const char *in_path;
+    const char *reference_path;
+    int num_threads;
+    int top;
+    size_t max_key_len;
+};
+
+static void crack_usage(const char *command) {
+    fprintf(stderr,
+            "Usage: cli %s [options] [message]\n"
+            "\n"
+            "If no message is given, the ciphertext is read from stdin (or --in).\n"
+            "\n"
+            "Options:\n"
+            "  --in PATH          read the ciphertext from PATH instead of stdin\n"
+            "  --threads N        use N threads (default 1)\n"
+            "  --reference PATH   expected plaintext frequencies, one number per character\n"
+            "                     of the range (default: English letter frequencies)\n"
+            "  --top K            report the K best candidates (default 5)\n"
+            "  --max-key-len N    longest Vigenere key to consider (default 32)\n",
+            command);
+}
+
+/** Parse the options of a cracking subcommand.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int parse_crack_options(int argc, char **argv, struct crack_options *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->num_threads = 1;
+    opts->top = 5;
+    opts->max_key_len = 32;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            if (opts->message != NULL) {
+                fprintf(stderr, "Error: Invalid number of arguments.\n");
+                return 1;
+            }
+            opts->message = arg;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (strcmp(arg, "--in") == 0) {
+            opts->in_path = value;
+        } else if (strcmp(arg, "--reference") == 0) {
+            opts->reference_path = value;
+        } else if (strcmp(arg, "--threads") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 1, CIPHER_MAX_THREADS, &n) != 0) {
+                return 1;
+            }
+            opts->num_threads = (int) n;
+        } else if (strcmp(arg, "--top") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 1, INT_MAX, &n) != 0) {
+                return 1;
+            }
+            opts->top = (int) n;
+        } else if (strcmp(arg, "--max-key-len") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 1, 4096, &n) != 0) {
+                return 1;
+            }
+            opts->max_key_len = (size_t) n;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s.\n", arg);
+            return 1;
+        }
+    }
+    if (opts->message != NULL && opts->in_path != NULL) {
+        fprintf(stderr, "Error: --in cannot be combined with a message argument.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/** Read `count` whitespace-separated frequencies from the file at `path`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int read_reference(const char *path, double *reference, int count) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (fscanf(f, "%lf", &reference[i]) != 1 || reference[i] < 0) {
+            fprintf(stderr, "Error: %s must contain %d non-negative numbers.\n", path, count);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/** Pass the ciphertext named by `opts` to `consume` in chunks of at most `chunk_size`
+  * bytes.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int read_ciphertext(const struct crack_options *opts, size_t chunk_size,
+                           void (*consume)(void *arg, const uint8_t *buf, size_t len),
+                           void *arg) {
+    if (opts->message != NULL) {
+        consume(arg, (const uint8_t *) opts->message, strlen(opts->message));
+        return 0;
+    }
+
+    int fd = STDIN_FILENO;
+    if (opts->in_path != NULL && strcmp(opts->in_path, "-") != 0) {
+        fd = open(opts->in_path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error: Cannot open %s: %s\n", opts->in_path, strerror(errno));
+            return 1;
+        }
+    }
+    uint8_t *buf = malloc(chunk_size);
+    int result = buf == NULL;
+    while (buf != NULL) {
+        ssize_t n = read(fd, buf, chunk_size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            result = n < 0;
+            break;
+        }
+        consume(arg, buf, (size_t) n);
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+    }
+    free(buf);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return result;
+}
+
+/** State for accumulating a histogram over a streamed ciphertext.
+  */
+struct histogram_job {
+    uint64_t hist[256];
+    int num_threads;
+};
+
+static void consume_histogram(void *arg, const uint8_t *buf, size_t len) {
+    struct histogram_job *job = arg;
+    byte_histogram(buf, len, job->hist, job->num_threads);
+}
+
+int cli_caesar_crack(int argc, char **argv) {
+    const char range_low = 'A';
+    const char range_high = 'Z';
+    const int range_size = range_high - range_low + 1;
+    struct crack_options opts;
+    double reference[256];
+    struct caesar_candidate ranked[256];
+
+    if (parse_crack_options(argc, argv, &opts) != 0) {
+        crack_usage(argv[0]);
+        return 1;
+    }
+    if (opts.reference_path != NULL
+        && read_reference(opts.reference_path, reference, range_size) != 0) {
+        return 1;
+    }
+
+    struct histogram_job job;
+    memset(&job, 0, sizeof(job));
+    job.num_threads = opts.num_threads;
+    if (read_ciphertext(&opts, (size_t) CIPHER_STREAM_CHUNK * opts.num_threads,
+                        consume_histogram, &job) != 0) {
+        return 1;
+    }
+
+    if (caesar_rank_shifts(range_low, range_high, job.hist,
+                           opts.reference_path != NULL ? reference : NULL, ranked) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("key\tchi_squared\n");
+    for (int i = 0; i < opts.top && i < range_size; ++i) {
+        printf("%d\t%.3f\n", ranked[i].shift, ranked[i].chi_squared);
+    }
+    return 0;
+}
+
+/** The in-range characters of a streamed ciphertext, compacted as they arrive.
+  */
+struct compact_job {
+    char range_low;
+    char range_high;
+    uint8_t *compact;
+    size_t n;
+    size_t capacity;
+    int failed;
+};
+
+static void consume_compact(void *arg, const uint8_t *buf, size_t len) {
+    struct compact_job *job = arg;
+    if (job->failed) {
+        return;
+    }
+    if (job->capacity - job->n < len) {
+        size_t capacity = job->capacity * 2 > job->n + len ? job->capacity * 2 : job->n + len;
+        uint8_t *compact = realloc(job->compact, capacity);
+        if (compact == NULL) {
+            job->failed = 1;
+            return;
+        }
+        job->compact = compact;
+        job->capacity = capacity;
+    }
+    job->n += compact_in_range(job->range_low, job->range_high, buf, len,
+                               job->compact + job->n);
+}
+
+int cli_vigenere_crack(int argc, char **argv) {
+    const char range_low = 'A';
+    const char range_high = 'Z';
+    const int range_size = range_high - range_low + 1;
+    struct crack_options opts;
+    double reference[256];
+
+    if (parse_crack_options(argc, argv, &opts) != 0) {
+        crack_usage(argv[0]);
+        return 1;
+    }
+    if (opts.reference_path != NULL
+        && read_reference(opts.reference_path, reference, range_size) != 0) {
+        return 1;
+    }
+
+    struct compact_job job = { .range_low = range_low, .range_high = range_high };
+    if (read_ciphertext(&opts, CIPHER_STREAM_CHUNK, consume_compact, &job) != 0) {
+        free(job.compact);
+        return 1;
+    }
+    if (job.failed) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(job.compact);
+        return 1;
+    }
+
+    struct vigenere_candidate *ranked = malloc(sizeof(*ranked) * opts.max_key_len);
+    uint8_t *key = malloc(opts.max_key_len);
+    int result = 0;
+    /* Columns of only a few characters give meaningless coincidence counts. */
+    if (opts.max_key_len > job.n / 8) {
+        opts.max_key_len = job.n / 8 > 0 ? job.n / 8 : 1;
+    }
+    if (ranked == NULL || key == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        result = 1;
+    } else {
+        vigenere_rank_key_lengths(range_size, job.compact, job.n, opts.max_key_len,
+                                  opts.num_threads, ranked);
+        printf("key_length\tioc\tkey\n");
+        for (int i = 0; i < opts.top && (size_t) i < opts.max_key_len && result == 0; ++i) {
+            if (vigenere_solve_key(range_low, range_high, job.compact, job.n,
+                                   ranked[i].key_len,
+                                   opts.reference_path != NULL ? reference : NULL,
+                                   opts.num_threads, key) != 0) {
+                fprintf(stderr, "Error: %s\n", strerror(errno));
+                result = 1;
+                break;
+            }
+            printf("%zu\t%.5f\t%.*s\n", ranked[i].key_len, ranked[i].ioc,
+                   (int) ranked[i].key_len, (const char *) key);
+        }
+    }
+    free(ranked);
+    free(key);
+    free(job.compact);
+    return result;
+}
@@ -1,6 +1,9 @@
 #ifndef CRYPTO_H
 #define CRYPTO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /** Encrypt a given plaintext using the Caesar cipher, using a specified key, where the
   * characters to encrypt fall within a given range (and all other characters are copied
   * over unchanged).
@@ -127,56 +130,1121 @@ void vigenere_encrypt(char range_low, char range_high, const char *key,
   */
 void vigenere_decrypt(char range_low, char range_high, const char * key, const char * cipher_text, char * plain_text);
 
-/** TODO
- */
+/** Encrypt `len` bytes from `in` using the Caesar cipher, writing the result to `out`.
+  *
+  * This is the length-explicit counterpart of `caesar_encrypt`: it neither requires nor
+  * writes a terminating null character, so `in` may contain arbitrary binary data
+  * (including null bytes, which are copied through like any other out-of-range byte).
+  * `in` and `out` may be the same buffer, in which case the data is encrypted in place.
+  * Bytes and range bounds are compared as unsigned values.
+  *
+  * \param range_low The lower bound of the character range to be encrypted
+  * \param range_high The upper bound of the character range
+  * \param shift The encryption key; any value is reduced modulo the size of the range
+  * \param in The bytes to encrypt
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the ciphertext
+  *
+  * \pre `range_high` must be strictly greater than `range_low`.
+  * \pre `in` and `out` must either be identical or not overlap.
+  */
+void caesar_encrypt_buf(char range_low, char range_high, int shift,
+                        const uint8_t *in, size_t len, uint8_t *out);
+
+/** Decrypt `len` bytes from `in` using the Caesar cipher, writing the result to `out`.
+  *
+  * Calling `caesar_decrypt_buf` with some key $n$ exactly reverses `caesar_encrypt_buf`
+  * called with the same key. See `caesar_encrypt_buf` for the buffer requirements.
+  */
+void caesar_decrypt_buf(char range_low, char range_high, int shift,
+                        const uint8_t *in, size_t len, uint8_t *out);
+
+/** Encrypt `len` bytes from `in` using the Vigenere cipher, writing the result to `out`.
+  *
+  * This is the length-explicit counterpart of `vigenere_encrypt`. The buffer rules are
+  * the same as for `caesar_encrypt_buf`, and the key need not be null-terminated.
+  *
+  * Encryption starts at position `key_index` in the key, and the position reached after
+  * the last in-range byte is returned, so a long input can be encrypted piecewise by
+  * passing each call the value returned by the previous one. Each key character shifts
+  * by its distance from `range_low`, reduced modulo the size of the range.
+  *
+  * \param range_low The lower bound of the character range to be encrypted
+  * \param range_high The upper bound of the character range
+  * \param key The encryption key
+  * \param key_len The number of characters in `key`
+  * \param key_index The position in `key` at which to start (0 for a fresh message)
+  * \param in The bytes to encrypt
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the ciphertext
+  * \return The key position at which to continue with the next piece of input
+  *
+  * \pre `range_high` must be strictly greater than `range_low`.
+  * \pre `key_len` must be greater than 0.
+  * \pre `in` and `out` must either be identical or not overlap.
+  */
+size_t vigenere_encrypt_buf(char range_low, char range_high, const uint8_t *key,
+                            size_t key_len, size_t key_index,
+                            const uint8_t *in, size_t len, uint8_t *out);
+
+/** Decrypt `len` bytes from `in` using the Vigenere cipher, writing the result to `out`.
+  *
+  * Exactly reverses `vigenere_encrypt_buf` called with the same key and starting
+  * `key_index`, and returns the key position reached in the same way.
+  */
+size_t vigenere_decrypt_buf(char range_low, char range_high, const uint8_t *key,
+                            size_t key_len, size_t key_index,
+                            const uint8_t *in, size_t len, uint8_t *out);
+
+/** Count the bytes of `in` that fall within the range `range_low` to `range_high`.
+  *
+  * This is the number of positions a Vigenere key advances over the same input, which
+  * lets a long input be split into independently processed pieces.
+  *
+  * \param range_low The lower bound of the character range
+  * \param range_high The upper bound of the character range
+  * \param in The bytes to examine
+  * \param len The number of bytes in `in`
+  * \return The number of in-range bytes
+  */
+size_t count_in_range(char range_low, char range_high, const uint8_t *in, size_t len);
+
+/** Kernels compiled for one commonly used range, with its bounds and size as constants.
+  *
+  * `caesar` takes a shift already reduced to `[0, range_size)`; the Vigenere kernels
+  * follow `vigenere_encrypt_buf` and `vigenere_decrypt_buf` but take no range and need
+  * `key_index < key_len`. The generic `*_buf` functions use these automatically for the
+  * ranges that have them.
+  */
+struct fixed_range {
+    uint8_t low;
+    uint8_t high;
+    void (*caesar)(int shift, const uint8_t *in, size_t len, uint8_t *out);
+    size_t (*vigenere_encrypt)(const uint8_t *key, size_t key_len, size_t key_index,
+                               const uint8_t *in, size_t len, uint8_t *out);
+    size_t (*vigenere_decrypt)(const uint8_t *key, size_t key_len, size_t key_index,
+                               const uint8_t *in, size_t len, uint8_t *out);
+};
+
+/** Return the specialised kernels for the range `range_low`..`range_high`, or NULL if
+  * there are none. Kernels exist for 'A'..'Z', 'a'..'z' and ' '..'~'.
+  */
+const struct fixed_range *fixed_range_find(char range_low, char range_high);
+
+/** Instruction set extensions that the bulk kernels can use, in increasing order of
+  * width.
+  */
+enum simd_level {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_SSSE3,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+/** Return the widest instruction set supported by the running CPU (detected via cpuid
+  * on first use), or the level most recently set with `simd_set_level`.
+  */
+enum simd_level simd_level(void);
+
+/** Restrict the bulk kernels to at most `level`, for benchmarking and testing the
+  * narrower code paths. Levels the CPU does not support are never selected.
+  */
+void simd_set_level(enum simd_level level);
+
+/** Caesar-encrypt as much of `in` as the selected vector kernel can handle in whole
+  * vectors, returning the number of bytes processed. The caller handles the remaining
+  * `len - result` bytes (all of them, on CPUs without SIMD support).
+  *
+  * \pre `0 < shift < range_size`, and `range_size` is at most 256.
+  */
+size_t caesar_simd(uint8_t low, int range_size, int shift,
+                   const uint8_t *in, size_t len, uint8_t *out);
+
+/** Smallest period accepted by `vigenere_simd`; see `vigenere_schedule`.
+  */
+#define VIGENERE_SIMD_MIN_PERIOD 64
+
+/** Number of bytes `vigenere_simd` may read past position `period - 1` of a schedule.
+  */
+#define VIGENERE_SIMD_OVERREAD 16
+
+/** Number of entries a `vigenere_schedule` for a key of `key_len` characters needs.
+  */
+#define VIGENERE_SCHEDULE_LEN(key_len) \
+    ((key_len) + VIGENERE_SIMD_MIN_PERIOD - 1 + VIGENERE_SIMD_OVERREAD)
+
+/** Expand a Vigenere key into the shift schedule used by `vigenere_simd`.
+  *
+  * The key is repeated a whole number of times to give a period of at least
+  * `VIGENERE_SIMD_MIN_PERIOD` characters, and each character is replaced by the shift it
+  * applies (or, if `decrypt` is nonzero, the shift that undoes it). Position `i` of the
+  * schedule corresponds to key position `i % key_len`.
+  *
+  * \param shifts A buffer of at least `VIGENERE_SCHEDULE_LEN(key_len)` bytes
+  * \return The period of the schedule
+  */
+size_t vigenere_schedule(char range_low, char range_high, const uint8_t *key,
+                         size_t key_len, int decrypt, uint8_t *shifts);
+
+/** Apply a repeating schedule of per-character shifts to as much of `in` as the selected
+  * vector kernel can handle in whole vectors, returning the number of bytes processed.
+  *
+  * The n-th in-range byte is shifted by `shifts[(*pos + n) % period]`, and `*pos` is
+  * advanced past every in-range byte processed. The caller handles the remaining
+  * `len - result` bytes.
+  *
+  * \pre `period` is at least `VIGENERE_SIMD_MIN_PERIOD`, `shifts` holds
+  *      `period + VIGENERE_SIMD_OVERREAD` entries with `shifts[i] == shifts[i % period]`,
+  *      and every entry is less than `range_size`.
+  * \pre `*pos < period`
+  */
+size_t vigenere_simd(uint8_t low, int range_size, const uint8_t *shifts, size_t period,
+                     size_t *pos, const uint8_t *in, size_t len, uint8_t *out);
+
+/** Count the in-range bytes in as much of `in` as the selected vector kernel can handle
+  * in whole vectors, adding the count to `*count` and returning the number of bytes
+  * examined.
+  */
+size_t count_in_range_simd(uint8_t low, int range_size, const uint8_t *in, size_t len,
+                           size_t *count);
+
+/** Size of the blocks classified by `scan_blocks_simd`.
+  */
+#define CIPHER_SCAN_BLOCK 64
+
+/** Most bytes the sparse mode of a `cipher_ctx` scans before transforming or copying
+  * them, so that they are still in cache when it does.
+  */
+#define CIPHER_SCAN_SPAN (8 << 10)
+
+/** Measure the run of whole `CIPHER_SCAN_BLOCK`-byte blocks at the start of `in` that
+  * each contain at least one in-range byte (if `busy` is nonzero) or none at all (if
+  * `busy` is 0), returning its length in bytes. A partial block at the end is never
+  * included, and on CPUs without SIMD support the result is always 0.
+  */
+size_t scan_blocks_simd(uint8_t low, int range_size, int busy, const uint8_t *in,
+                        size_t len);
+
+/** Operations understood by the streaming and bulk interfaces.
+  */
+enum cipher_op {
+    CAESAR_ENCRYPT,
+    CAESAR_DECRYPT,
+    VIGENERE_ENCRYPT,
+    VIGENERE_DECRYPT
+};
+
+/** Look up an operation by its command-line name (`caesar-encrypt`, `caesar-decrypt`,
+  * `vigenere-encrypt` or `vigenere-decrypt`).
+  *
+  * \return 0 on success, or -1 if `name` is not an operation
+  */
+int cipher_op_from_name(const char *name, enum cipher_op *op);
+
+/** Return the command-line name of an operation.
+  */
+const char *cipher_op_name(enum cipher_op op);
+
+/** Output formats of `metrics_dump`.
+  */
+enum metrics_format {
+    /** The Prometheus text exposition format. */
+    METRICS_PROMETHEUS,
+    /** A JSON object with one member per operation. */
+    METRICS_JSON
+};
+
+/** Turn the collection of runtime metrics on or off. It is off by default.
+  *
+  * While metrics are on, every call to the `_buf` functions (and so the string functions
+  * built on them), `cipher_ctx_apply` and `multi_ctx_apply` counts its bytes, its
+  * in-range bytes and its latency against its operation. Each thread records into its own
+  * counters and a latency histogram with buckets 12.5% wide, so recording takes no lock;
+  * the in-range count costs one extra pass over the output. While metrics are off the
+  * only cost is one load of a flag per call.
+  */
+void metrics_enable(int on);
+
+/** Return nonzero if runtime metrics are being collected.
+  */
+int metrics_enabled(void);
+
+/** Return a monotonic timestamp in nanoseconds, for measuring what to pass to
+  * `metrics_record`.
+  */
+uint64_t metrics_clock(void);
+
+/** Record one call of `op` in the calling thread's counters.
+  *
+  * \param op The operation performed
+  * \param bytes The number of bytes transformed
+  * \param in_range How many of them were within the range
+  * \param elapsed_ns How long the call took
+  */
+void metrics_record(enum cipher_op op, size_t bytes, size_t in_range, uint64_t elapsed_ns);
+
+/** Merge the counters of every thread and write them to `fd`.
+  *
+  * The counters are read without stopping the threads that update them, so a dump taken
+  * while calls are in progress may miss the latest of them.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int metrics_dump(int fd, enum metrics_format format);
+
+/** Look up a metrics format by name (`prometheus` or `json`).
+  *
+  * \return 0 on success, or -1 if `name` is not a format
+  */
+int metrics_format_from_name(const char *name, enum metrics_format *format);
+
+/** Start a thread that calls `metrics_dump(fd, format)` whenever signal `signo` arrives.
+  *
+  * `signo` is blocked in the calling thread, and must be blocked in every other thread
+  * for the dump thread to receive it, so this should be called before any other threads
+  * are started.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int metrics_watch_signal(int signo, int fd, enum metrics_format format);
+
+/** A cipher with its range and key compiled into lookup tables, for reuse across many
+  * messages.
+  *
+  * For the Caesar operations `table` maps every byte to its output, so the scalar loop is
+  * a single lookup per byte. For the Vigenere operations `table` holds 1 for in-range
+  * bytes and 0 otherwise; keys of up to 64 characters also get a 256-entry translation
+  * table per key position in `key_tables`, and longer keys use the precomputed shift
+  * schedule in `shifts`. Whole vectors go through the SIMD kernels either way.
+  *
+  * A context is not modified by `cipher_ctx_apply`, so one context may be shared by any
+  * number of threads.
+  *
+  * Setting `sparse` after `cipher_ctx_init` suits inputs where in-range bytes are rare,
+  * such as UTF-8 text or binary data: the input is first scanned for blocks of
+  * `CIPHER_SCAN_BLOCK` bytes with no in-range byte, which are copied through (or, in
+  * place, not written at all), and only the rest is transformed. The output is the same
+  * either way. With a range within ASCII, the bytes of multibyte UTF-8 sequences, all
+  * 0x80 or above, are out of range and so are never altered.
+  */
+struct cipher_ctx {
+    enum cipher_op op;
+    uint8_t low;
+    uint8_t high;
+    int range_size;
+    int shift;
+    uint8_t table[256];
+    size_t key_len;
+    uint8_t *shifts;
+    size_t period;
+    uint8_t *key_tables;
+    int sparse;
+};
+
+/** Compile a cipher into `ctx`.
+  *
+  * Decryption is folded into the tables, so a context created for `CAESAR_DECRYPT` or
+  * `VIGENERE_DECRYPT` is applied exactly like one created for encryption.
+  *
+  * \param ctx The context to initialise
+  * \param op The operation to perform
+  * \param range_low The lower bound of the character range to be transformed
+  * \param range_high The upper bound of the character range
+  * \param shift The Caesar shift (ignored for the Vigenere operations)
+  * \param key The Vigenere key (ignored for the Caesar operations); it is copied into the
+  *           context, and need not outlive it
+  * \param key_len The number of characters in `key`
+  * \return 0 on success, or -1 on failure (with `errno` set to `EINVAL` if the range is
+  *         empty or the Vigenere key is, or `ENOMEM`)
+  */
+int cipher_ctx_init(struct cipher_ctx *ctx, enum cipher_op op, char range_low,
+                    char range_high, int shift, const uint8_t *key, size_t key_len);
+
+/** Release the memory held by a context initialised with `cipher_ctx_init`.
+  */
+void cipher_ctx_free(struct cipher_ctx *ctx);
+
+/** Transform `len` bytes from `in` into `out` (which may be the same buffer).
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param key_index The Vigenere key position at which to start (ignored for Caesar)
+  * \param in The bytes to transform
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the output
+  * \return The key position at which to continue with the next piece of input
+  */
+size_t cipher_ctx_apply(const struct cipher_ctx *ctx, size_t key_index,
+                        const uint8_t *in, size_t len, uint8_t *out);
+
+/** One record of a batch: `len` bytes at `in` to be transformed into `out`.
+  */
+struct cipher_span {
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+};
+
+/** Transform many records with one context in a single call.
+  *
+  * The per-call set-up (key length, schedule and tables) is paid once in
+  * `cipher_ctx_init` rather than once per record. If `continue_key` is nonzero, the
+  * Vigenere key carries on from one record to the next exactly as if the records were
+  * concatenated; otherwise every record starts at `key_index`.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param key_index The Vigenere key position at which to start (ignored for Caesar)
+  * \param spans The records to transform; each `in` may equal its `out`
+  * \param num_spans The number of records
+  * \param continue_key Whether the key continues across records
+  * \return The key position after the last record if `continue_key` is nonzero, and
+  *         `key_index` otherwise
+  */
+size_t cipher_ctx_apply_batch(const struct cipher_ctx *ctx, size_t key_index,
+                              const struct cipher_span *spans, size_t num_spans,
+                              int continue_key);
+
+/** Transform many records packed into one buffer.
+  *
+  * Record `i` occupies bytes `offsets[i]` to `offsets[i + 1] - 1` of `in`, and its output
+  * is written to the same offsets of `out` (which may be `in`). Where records do not
+  * need separate key handling (Caesar, or a continuing key) the whole range is processed
+  * in one vectorised pass.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param key_index The Vigenere key position at which to start (ignored for Caesar)
+  * \param in The packed input records
+  * \param offsets `num_records + 1` non-decreasing offsets into `in`
+  * \param num_records The number of records
+  * \param out A buffer the same size as `in` to receive the output
+  * \param continue_key Whether the key continues across records
+  * \return As for `cipher_ctx_apply_batch`
+  */
+size_t cipher_ctx_apply_packed(const struct cipher_ctx *ctx, size_t key_index,
+                               const uint8_t *in, const size_t *offsets, size_t num_records,
+                               uint8_t *out, int continue_key);
+
+/** The most ranges a `multi_ctx` can rotate at once.
+  */
+#define CIPHER_MAX_RANGES 8
+
+/** An inclusive character range, `low` to `high`.
+  */
+struct cipher_range {
+    char low;
+    char high;
+};
+
+/** How the Vigenere key advances when several ranges are encrypted together.
+  */
+enum key_policy {
+    /** One key position, advanced by a character of any of the ranges. */
+    KEY_SHARED,
+    /** A key position per range, advanced only by characters of that range. */
+    KEY_PER_RANGE
+};
+
+/** A cipher over a set of disjoint ranges, each rotated within itself, applied in a
+  * single table-driven pass.
+  *
+  * `range_of` maps each byte to 1 plus the number of its range, or 0 if it is in none.
+  * For the Caesar operations `table` maps every byte to its output; for the Vigenere
+  * operations `key_tables` holds one such 256-entry table per key position.
+  *
+  * `sparse` works as for a `cipher_ctx`, with blocks scanned for bytes between the
+  * lowest and highest of the ranges.
+  */
+struct multi_ctx {
+    enum cipher_op op;
+    enum key_policy policy;
+    int num_ranges;
+    uint8_t low[CIPHER_MAX_RANGES];
+    int range_size[CIPHER_MAX_RANGES];
+    uint8_t range_of[256];
+    uint8_t table[256];
+    size_t key_len;
+    uint8_t *key_tables;
+    int sparse;
+};
+
+/** Compile a cipher over several ranges into `ctx`.
+  *
+  * The Caesar shift is reduced separately modulo the size of each range. Each Vigenere
+  * key character gives an offset relative to the range it is applied in, as it would for
+  * `vigenere_encrypt` over that range alone, so the order of the ranges does not matter.
+  * With `KEY_PER_RANGE` the result matches one single-range cipher per range, and with
+  * one range it matches `cipher_ctx_init`.
+  *
+  * \param ctx The context to initialise
+  * \param op The operation to perform
+  * \param ranges The ranges to transform, which must not overlap
+  * \param num_ranges The number of ranges, from 1 to `CIPHER_MAX_RANGES`
+  * \param shift The shift, for the Caesar operations
+  * \param key The key, for the Vigenere operations
+  * \param key_len The length of `key`, for the Vigenere operations
+  * \param policy How the Vigenere key advances across ranges
+  * \return 0 on success, or -1 on failure (with `errno` set to `EINVAL` for an empty,
+  *     reversed or overlapping range or an empty key, or `ENOMEM`)
+  */
+int multi_ctx_init(struct multi_ctx *ctx, enum cipher_op op, const struct cipher_range *ranges,
+                   int num_ranges, int shift, const uint8_t *key, size_t key_len,
+                   enum key_policy policy);
+
+/** Free the tables allocated by `multi_ctx_init`.
+  */
+void multi_ctx_free(struct multi_ctx *ctx);
+
+/** Apply a multi-range cipher to `len` bytes in a single pass.
+  *
+  * \param ctx A context initialised with `multi_ctx_init`
+  * \param key_index The key position to start at, updated to where the next piece of
+  *     input should continue: one entry for `KEY_SHARED`, or one per range for
+  *     `KEY_PER_RANGE`. Unused by the Caesar operations.
+  * \param in The bytes to transform
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the output, which may be `in`
+  */
+void multi_ctx_apply(const struct multi_ctx *ctx, size_t *key_index, const uint8_t *in,
+                     size_t len, uint8_t *out);
+
+/** Parse a comma-separated list of ranges such as `A-Z,a-z,0-9`.
+  *
+  * \param spec The list to parse
+  * \param ranges A buffer of `CIPHER_MAX_RANGES` entries
+  * \return The number of ranges, or -1 if `spec` is malformed or has too many
+  */
+int parse_ranges(const char *spec, struct cipher_range *ranges);
+
+/** Parse the value of a command-line option as a decimal integer between `min` and `max`,
+  * inclusive. The whole of `value` must be the number.
+  *
+  * \param option The name of the option, for the error message
+  * \param value The option's value
+  * \param min The smallest value allowed
+  * \param max The largest value allowed
+  * \param result Where to store the value
+  * \return 0 on success, 1 on failure (after printing an error naming `option`)
+  */
+int parse_long_option(const char *option, const char *value, long min, long max,
+                      long *result);
+
+/** Largest number of threads `cipher_ctx_apply_parallel` will use.
+  */
+#define CIPHER_MAX_THREADS 256
+
+/** Call `fn(arg, i)` for every `i` from 0 to `num_tasks - 1` concurrently, one thread per
+  * task (the calling thread runs task 0), and wait for them all to finish. A task whose
+  * thread cannot be started is run on the calling thread instead.
+  *
+  * \pre `num_tasks` is at most `CIPHER_MAX_THREADS`
+  */
+void run_parallel(int num_tasks, void (*fn)(void *arg, int index), void *arg);
+
+/** Transform `len` bytes from `in` into `out` like `cipher_ctx_apply`, splitting the work
+  * across up to `num_threads` threads.
+  *
+  * For the Vigenere operations a fast counting pass over each chunk first determines the
+  * key position at which that chunk starts, so the output is identical to a single
+  * `cipher_ctx_apply` call. Inputs too small to benefit are processed on the calling
+  * thread.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param key_index The Vigenere key position at which to start (ignored for Caesar)
+  * \param in The bytes to transform
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the output
+  * \param num_threads The maximum number of threads to use, including the caller
+  * \return The key position at which to continue with the next piece of input
+  */
+size_t cipher_ctx_apply_parallel(const struct cipher_ctx *ctx, size_t key_index,
+                                 const uint8_t *in, size_t len, uint8_t *out,
+                                 int num_threads);
+
+/** Transform the file at `in_path` by mapping it into memory, writing the result to
+  * `out_path`.
+  *
+  * The cipher is applied directly to the mapped pages (using up to `num_threads` threads)
+  * with no intermediate buffer, so the only data movement is through the page cache. If
+  * `out_path` is NULL or names the same file as `in_path`, the file is transformed in
+  * place through a shared writable mapping; otherwise `out_path` is created or truncated
+  * and sized to match the input before it is mapped.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param in_path The path of a regular file to read
+  * \param out_path The path of the file to write, or NULL to transform `in_path` in place
+  * \param num_threads The maximum number of threads to use
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int cipher_mmap_file(const struct cipher_ctx *ctx, const char *in_path,
+                     const char *out_path, int num_threads);
+
+/** One file for `cipher_run_jobs`.
+  *
+  * `in_path`, `out_path` and `key_index` are set by the caller; `size` and `error` are
+  * filled in by the run.
+  */
+struct cipher_job {
+    const char *in_path;
+    const char *out_path;
+    size_t key_index;
+    uint64_t size;
+    int error;
+};
+
+/** Transform many files concurrently.
+  *
+  * Each file is split into chunks of `chunk_size` bytes, which are dealt round-robin to
+  * `num_threads` workers; a worker that runs out of chunks steals from the others, so a
+  * single large file still keeps every thread busy. Each output is created (or resized)
+  * to match its input and written at the same offsets, so an output naming the input
+  * file transforms it in place.
+  *
+  * For the Vigenere operations each file starts at its own `key_index`, or, if
+  * `chain_keys` is nonzero, every file after the first continues from where the key
+  * reached at the end of the one before. The chunks that do not start a file at a known
+  * key index are first counted in a separate parallel round. When the key is chained, a
+  * file that fails stops the chain: every file after it fails with `ECANCELED`.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`
+  * \param jobs The files to transform
+  * \param num_jobs The number of entries in `jobs`
+  * \param chain_keys Nonzero to run the Vigenere key on from each file into the next
+  * \param chunk_size The largest piece of a file processed as one task
+  * \param num_threads The number of threads to use, including the caller
+  * \return 0 if every file was transformed, or -1 if any failed (with `errno` set to
+  *     the first failure; the error of each file is in its `error` field)
+  */
+int cipher_run_jobs(const struct cipher_ctx *ctx, struct cipher_job *jobs, size_t num_jobs,
+                    int chain_keys, size_t chunk_size, int num_threads);
+
+/** Relative frequencies (in percent) of the letters 'A' to 'Z' in English text, used as
+  * the default reference distribution for key recovery.
+  */
+extern const double english_letter_frequencies[26];
+
+/** Add the number of occurrences of each byte value in `in` to `hist`, using up to
+  * `num_threads` threads.
+  */
+void byte_histogram(const uint8_t *in, size_t len, uint64_t hist[256], int num_threads);
+
+/** A candidate Caesar key and how well the text it decrypts to fits the reference
+  * distribution (lower is better).
+  */
+struct caesar_candidate {
+    int shift;
+    double chi_squared;
+};
+
+/** Rank every possible Caesar key for a ciphertext, given only its byte histogram.
+  *
+  * Each shift from 0 to `range_high - range_low` is scored by the chi-squared distance
+  * between the character frequencies it would decrypt to and `reference`. The scoring
+  * permutes histogram bins rather than decrypting the text, so its cost does not depend
+  * on the length of the ciphertext.
+  *
+  * \param range_low The lower bound of the character range used for encryption
+  * \param range_high The upper bound of the character range
+  * \param hist The byte histogram of the ciphertext (see `byte_histogram`)
+  * \param reference The expected relative frequency of each character of the range in
+  *           the plaintext, or NULL to use `english_letter_frequencies` (only valid for
+  *           a range of 26 characters)
+  * \param ranked A buffer of `range_high - range_low + 1` entries, which receives every
+  *           shift, best first
+  * \return 0 on success, or -1 with `errno` set to `EINVAL` if the range or reference
+  *         distribution is unusable
+  */
+int caesar_rank_shifts(char range_low, char range_high, const uint64_t hist[256],
+                       const double *reference, struct caesar_candidate *ranked);
+
+/** Copy the in-range bytes of `in` to `out` as offsets from `range_low` (so each is
+  * between 0 and `range_high - range_low`), dropping all other bytes.
+  *
+  * This is the sequence of characters a Vigenere key is applied to, with the key position
+  * of each character equal to its index in `out` (modulo the key length).
+  *
+  * \param out A buffer of at least `len` bytes
+  * \return The number of bytes written to `out`
+  */
+size_t compact_in_range(char range_low, char range_high, const uint8_t *in, size_t len,
+                        uint8_t *out);
+
+/** A candidate Vigenere key length and the mean index of coincidence of the ciphertext
+  * columns it implies (higher is better).
+  */
+struct vigenere_candidate {
+    size_t key_len;
+    double ioc;
+};
+
+/** Rank the Vigenere key lengths from 1 to `max_key_len` for a compacted ciphertext.
+  *
+  * The candidates are scored in parallel on up to `num_threads` threads, using at most
+  * the first few million characters of `compact`. They are sorted by score, except that
+  * the shortest length scoring within 10% of the best is moved to the front, since every
+  * multiple of the true key length scores about as well as the length itself.
+  *
+  * \param range_size The number of characters in the range used for encryption
+  * \param compact The ciphertext as produced by `compact_in_range`
+  * \param n The number of characters in `compact`
+  * \param max_key_len The longest key length to consider
+  * \param num_threads The maximum number of threads to use
+  * \param ranked A buffer of `max_key_len` entries, which receives every length
+  */
+void vigenere_rank_key_lengths(int range_size, const uint8_t *compact, size_t n,
+                               size_t max_key_len, int num_threads,
+                               struct vigenere_candidate *ranked);
+
+/** Recover the most likely Vigenere key of length `key_len` for a compacted ciphertext.
+  *
+  * A single pass (split across up to `num_threads` threads) builds a histogram of every
+  * key column, and each column is then solved as a Caesar cipher with
+  * `caesar_rank_shifts`.
+  *
+  * \param key A buffer of `key_len` bytes, which receives the key (not null-terminated)
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int vigenere_solve_key(char range_low, char range_high, const uint8_t *compact, size_t n,
+                       size_t key_len, const double *reference, int num_threads,
+                       uint8_t *key);
+
+/** Size of the buffer used by `cipher_stream_fd` for each read/transform/write cycle,
+  * per thread.
+  */
+#define CIPHER_STREAM_CHUNK (1 << 20)
+
+/** Default spacing, in bytes, of the checkpoints in a seek index.
+  */
+#define SEEK_INDEX_INTERVAL (1 << 20)
+
+/** Size in bytes of the header of a seek index file.
+  *
+  * Every integer in the file is an unsigned 64-bit big-endian value unless noted. The
+  * header is
+  *
+  * - the four bytes `CSX\1`, then one byte each for the low and high ends of the range
+  *   and two reserved zeros;
+  * - the checkpoint interval;
+  * - the size of the indexed file;
+  * - the number of checkpoints, which is always `size / interval + 1`.
+  *
+  * It is followed by the checkpoints themselves: checkpoint `i` is the Vigenere key index
+  * in force at offset `i * interval`, that is the key index the stream started at plus the
+  * number of in-range bytes before that offset (not reduced modulo the key length).
+  */
+#define SEEK_INDEX_HEADER 32
+
+/** A sidecar index recording the Vigenere key position at regular offsets of a file, so
+  * that decryption can start anywhere without scanning everything before it.
+  *
+  * Since both ciphers map in-range bytes to in-range bytes, the same index describes a
+  * plaintext and its ciphertext, and can be built while either is read or written. An
+  * index does not depend on the key, only on the range.
+  */
+struct seek_index {
+    uint8_t low;
+    uint8_t high;
+    uint64_t interval;
+    uint64_t size;
+    uint64_t count;
+    uint64_t *counts;
+    size_t num_entries;
+    size_t capacity;
+    int error;
+};
+
+/** Start an empty index of the range `range_low`..`range_high`, with a checkpoint every
+  * `interval` bytes, for a stream that starts at key index `key_index`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int seek_index_init(struct seek_index *index, char range_low, char range_high,
+                    uint64_t interval, size_t key_index);
+
+/** Release the memory held by an index.
+  */
+void seek_index_free(struct seek_index *index);
+
+/** Extend an index over the next `len` bytes of the file.
+  *
+  * If memory runs out the index stops growing and remembers the error, which is then
+  * reported by `seek_index_save`.
+  *
+  * \param index An index started with `seek_index_init`
+  * \param data The next bytes of the plaintext or the ciphertext
+  * \param len The number of bytes in `data`
+  */
+void seek_index_update(struct seek_index *index, const uint8_t *data, size_t len);
+
+/** Write an index to the file at `path`, in the format described at `SEEK_INDEX_HEADER`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int seek_index_save(const struct seek_index *index, const char *path);
+
+/** Read an index written by `seek_index_save`. A file that is not a well-formed index
+  * fails with `EINVAL`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int seek_index_load(struct seek_index *index, const char *path);
+
+/** State for encrypting or decrypting an input that arrives in pieces.
+  *
+  * Feeding an input to `cipher_stream_update` in any number of chunks produces exactly
+  * the same output as passing the whole input to the corresponding string function in one
+  * call. For the Vigenere cipher this means `key_index` is carried over from one chunk to
+  * the next rather than restarting at 0.
+  *
+  * A stream applies either `ctx` or, if it was initialised with
+  * `cipher_stream_init_multi`, `multi`; a per-range key policy keeps its key positions in
+  * `range_key_index`. If `index` is set (for a stream with a `ctx` only), every chunk
+  * transformed is also added to it with `seek_index_update`.
+  */
+struct cipher_stream {
+    const struct cipher_ctx *ctx;
+    const struct multi_ctx *multi;
+    struct seek_index *index;
+    size_t key_index;
+    size_t range_key_index[CIPHER_MAX_RANGES];
+    int num_threads;
+};
+
+/** Initialise a stream that applies `ctx` from the start of a message.
+  *
+  * The stream is single-threaded; set `num_threads` afterwards to have each chunk
+  * processed by `cipher_ctx_apply_parallel`.
+  *
+  * \param stream The stream to initialise
+  * \param ctx A context initialised with `cipher_ctx_init`. It is not copied, and must
+  *           remain valid for as long as the stream is used.
+  */
+void cipher_stream_init(struct cipher_stream *stream, const struct cipher_ctx *ctx);
+
+/** Initialise a stream that applies the multi-range cipher `multi` from the start of a
+  * message. Such a stream is always single-threaded.
+  *
+  * \param stream The stream to initialise
+  * \param multi A context initialised with `multi_ctx_init`, which must remain valid for
+  *           as long as the stream is used
+  */
+void cipher_stream_init_multi(struct cipher_stream *stream, const struct multi_ctx *multi);
+
+/** Transform the next `len` bytes of input.
+  *
+  * `in` and `out` may point to the same buffer, in which case the chunk is transformed in
+  * place. Neither buffer needs to be null-terminated, and null bytes in the input are
+  * copied through like any other out-of-range byte.
+  *
+  * \param stream A stream initialised with `cipher_stream_init`
+  * \param in The next chunk of input
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the output
+  */
+void cipher_stream_update(struct cipher_stream *stream, const uint8_t *in, size_t len,
+                          uint8_t *out);
+
+/** Transform everything readable from `in_fd`, writing the result to `out_fd`.
+  *
+  * Input is processed in chunks of `CIPHER_STREAM_CHUNK` bytes per thread using a single
+  * buffer that is reused for every chunk, so memory use is constant however large the
+  * input is.
+  *
+  * \param stream A stream initialised with `cipher_stream_init`
+  * \param in_fd A file descriptor open for reading
+  * \param out_fd A file descriptor open for writing
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int cipher_stream_fd(struct cipher_stream *stream, int in_fd, int out_fd);
+
+/** Write all of `len` bytes from `buf` to `fd`, retrying after short writes and signals.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int write_all(int fd, const uint8_t *buf, size_t len);
+
+/** Where the key of a `keystream` comes from.
+  */
+enum keystream_kind {
+    KEYSTREAM_RUNNING,  /**< Read from a file or pipe, one character per in-range byte */
+    KEYSTREAM_AUTOKEY,  /**< A primer followed by the plaintext itself */
+};
+
+/** State for a Vigenere cipher whose key is as long as the message and never repeats.
+  *
+  * A running key is read from `key_fd` as the input is transformed, so it may be as long as
+  * the input and arrive from a pipe. A regular key file is mapped a window at a time
+  * rather than read. Either way only the key needed for the next piece of input is held in
+  * `shifts`, so memory use is constant however long the key is.
+  *
+  * The n-th in-range input byte is shifted by the n-th key character, as in the repeating
+  * Vigenere cipher; out-of-range input bytes are copied through and consume no key.
+  *
+  * For a running key and autokey encryption, `shifts[head]` to `shifts[tail - 1]` are
+  * the shifts of the key characters read but not yet used. For autokey decryption they
+  * are a ring of the last `tail` characters recovered, with `head` the next one to use.
+  */
+struct keystream {
+    enum keystream_kind kind;
+    enum cipher_op op;
+    uint8_t low;
+    uint8_t high;
+    int range_size;
+    int16_t shift_of[256];
+    uint8_t *shifts;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    int key_fd;
+    int key_mapped;
+    uint64_t key_size;
+    uint64_t window_offset;
+    uint8_t *window;
+    size_t window_len;
+    size_t window_pos;
+    uint8_t *read_buf;
+};
+
+/** Start a running-key cipher whose key is read from `key_fd`, beginning at its current
+  * position.
+  *
+  * \param ks The state to initialise
+  * \param op `VIGENERE_ENCRYPT` or `VIGENERE_DECRYPT`
+  * \param range_low The lowest character in the range
+  * \param range_high The highest character in the range
+  * \param key_fd A file descriptor open for reading. It is not closed by `keystream_free`.
+  * \param filter_key If nonzero, key characters outside the range are skipped rather than
+  *           reduced into it, so a text file can serve as the key for the letters alone
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int keystream_init_running(struct keystream *ks, enum cipher_op op, char range_low,
+                           char range_high, int key_fd, int filter_key);
+
+/** Start an autokey cipher, whose key is `primer` followed by the plaintext.
+  *
+  * \param ks The state to initialise
+  * \param op `VIGENERE_ENCRYPT` or `VIGENERE_DECRYPT`
+  * \param range_low The lowest character in the range
+  * \param range_high The highest character in the range
+  * \param primer The first characters of the key; it is copied
+  * \param primer_len The length of `primer`, which must not be 0
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int keystream_init_autokey(struct keystream *ks, enum cipher_op op, char range_low,
+                           char range_high, const uint8_t *primer, size_t primer_len);
+
+/** Release the buffer and any mapping held by a key stream.
+  */
+void keystream_free(struct keystream *ks);
+
+/** Transform the next `len` bytes of input, which may be done in place.
+  *
+  * \param ks A key stream initialised with `keystream_init_running` or
+  *           `keystream_init_autokey`
+  * \param in The next chunk of input
+  * \param len The number of bytes in `in`
+  * \param out A buffer of at least `len` bytes to receive the output
+  * \return 0 on success, or -1 on failure (with `errno` set to `ENODATA` if a running key
+  *     ran out before the input did)
+  */
+int keystream_update(struct keystream *ks, const uint8_t *in, size_t len, uint8_t *out);
+
+/** Transform everything readable from `in_fd` with a key stream, writing the result to
+  * `out_fd`, in chunks of `CIPHER_STREAM_CHUNK` bytes like `cipher_stream_fd`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int keystream_fd(struct keystream *ks, int in_fd, int out_fd);
+
+/** The most buffers `cipher_async_fd` can keep in flight.
+  */
+#define CIPHER_ASYNC_MAX_DEPTH 64
+
+/** How `cipher_async_fd` performs its I/O.
+  */
+enum async_backend {
+    /** io_uring where the kernel supports it, and threads otherwise. */
+    ASYNC_AUTO,
+    /** io_uring only, failing where it is unavailable. */
+    ASYNC_IO_URING,
+    /** A reader thread and a writer thread around the transforming thread. */
+    ASYNC_THREADS
+};
+
+/** What a `cipher_async_fd` call achieved.
+  */
+struct cipher_async_stats {
+    uint64_t bytes;
+    double seconds;
+    int used_io_uring;
+};
+
+/** Read everything from `in_fd`, transform it with `stream`, and write it to `out_fd`,
+  * overlapping the reads, the transformation and the writes.
+  *
+  * `queue_depth` buffers of `CIPHER_STREAM_CHUNK` bytes per stream thread are allocated
+  * once. With io_uring they are registered with the kernel; every free buffer has a read
+  * in flight when the input is a regular file (one at a time otherwise), and transformed
+  * buffers are written back concurrently. Chunks are always transformed in input order,
+  * so the output is identical to that of `cipher_stream_fd`. On return the file
+  * positions of both descriptors are left after the data transferred.
+  *
+  * \param stream A stream initialised with `cipher_stream_init` or
+  *     `cipher_stream_init_multi`
+  * \param in_fd The file descriptor to read from
+  * \param out_fd The file descriptor to write to
+  * \param queue_depth The number of buffers, from 2 to `CIPHER_ASYNC_MAX_DEPTH`
+  * \param backend How to perform the I/O
+  * \param stats If not NULL, receives the bytes transformed and the time taken
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+int cipher_async_fd(struct cipher_stream *stream, int in_fd, int out_fd, int queue_depth,
+                    enum async_backend backend, struct cipher_async_stats *stats);
+
+/** Transform `length` bytes of the file `in_fd`, starting at `offset`, writing the result
+  * to `out_fd`.
+  *
+  * This is meant for decrypting part of a large Vigenere ciphertext, whose key position
+  * at `offset` depends on everything before it. With an `index` built when the file was
+  * written, reading starts at the last checkpoint at or before `offset`, so at most
+  * `index->interval` bytes are scanned before the range; with no index the file is
+  * scanned from the start. The range ends early at the end of the file.
+  *
+  * \param ctx A context initialised with `cipher_ctx_init`, normally for decryption,
+  *     over the same range as `index`
+  * \param index The seek index of `in_fd`, or NULL
+  * \param in_fd A regular file open for reading; its file position is not used or changed
+  * \param offset The offset of the first byte to transform
+  * \param length The largest number of bytes to transform
+  * \param out_fd A file descriptor open for writing
+  * \param num_threads The maximum number of threads to use, including the caller
+  * \return 0 on success, or -1 on failure (with `errno` set to `EINVAL` if `index` does
+  *     not match `ctx` or the size of the file)
+  */
+int cipher_decrypt_range(const struct cipher_ctx *ctx, const struct seek_index *index,
+                         int in_fd, uint64_t offset, uint64_t length, int out_fd,
+                         int num_threads);
+
+/** Entry point for `cli bench`, which measures the throughput of each cipher function
+  * and implementation variant over a range of input sizes, densities, key lengths and
+  * character ranges, printing the results as CSV or JSON.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_bench(int argc, char **argv);
+
+/** Check every implementation of the ciphers against a byte-at-a-time reference on one
+  * case decoded from arbitrary bytes, for use as the body of a fuzzer's entry point.
+  *
+  * The first byte selects the operation (low two bits) and the starting key index (the
+  * rest); the next two are the ends of the range, then a big-endian 16-bit signed Caesar
+  * shift, then a byte giving the key length (1 + n % 64). The key follows, and the input
+  * is everything after it. Data too short to hold a case, or with an empty range, is
+  * accepted without checking anything.
+  *
+  * \return 0 if every implementation agrees with the reference, or -1 (after describing
+  *     the first difference on stderr) if not
+  */
+int cipher_verify_bytes(const uint8_t *data, size_t size);
+
+/** Entry point for `cli verify`, which runs `cipher_verify_bytes`-style checks over many
+  * random cases, or over one case given as a file.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 if every check passed, 1 otherwise
+  */
+int cli_verify(int argc, char **argv);
+
+/** Entry point for `cli caesar-crack`, which prints the most likely keys for a Caesar
+  * ciphertext.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_caesar_crack(int argc, char **argv);
+
+/** Entry point for `cli vigenere-crack`, which prints the most likely key lengths for a
+  * Vigenere ciphertext and the most likely key of each length.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_vigenere_crack(int argc, char **argv);
+
+/** Size in bytes of the fixed part of a daemon request frame, including its length
+  * prefix.
+  *
+  * Every integer in the daemon protocol is an unsigned 32-bit big-endian value unless
+  * noted. A request frame is
+  *
+  * - the length of the rest of the frame;
+  * - a request id, echoed in the response;
+  * - one byte each for the operation (an `enum cipher_op`), the low and high ends of the
+  *   range, and a reserved 0;
+  * - the Caesar shift (signed; ignored by the Vigenere operations);
+  * - the Vigenere key index to start at (ignored by the Caesar operations);
+  * - the key length, followed by the key (empty for the Caesar operations);
+  * - the payload, which runs to the end of the frame.
+  *
+  * Many requests may be sent on a connection without waiting for their responses.
+  */
+#define DAEMON_REQUEST_HEADER 24
+
+/** Size in bytes of the fixed part of a daemon response frame, including its length
+  * prefix.
+  *
+  * A response frame is the length of the rest of the frame, the request id, a status (0,
+  * or an `errno` value if the request failed), the Vigenere key index reached at the end
+  * of the payload, and the transformed payload (empty on failure). Responses on a
+  * connection are sent in the order of their requests.
+  */
+#define DAEMON_RESPONSE_HEADER 16
+
+/** The largest frame length the daemon accepts; a longer frame closes the connection.
+  */
+#define DAEMON_MAX_FRAME (64 << 20)
+
+/** Entry point for `cli serve`, which answers cipher requests on a Unix domain socket
+  * until it receives SIGINT or SIGTERM.
+  *
+  * A pool of worker threads serves the connections, sharing a cache of compiled cipher
+  * contexts so that repeated keys are only compiled once.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_serve(int argc, char **argv);
+
+/** Entry point for `cli client`, which sends requests to a running `cli serve` and prints
+  * the results.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_client(int argc, char **argv);
+
+/** Entry point for `cli jobs`, which transforms every file listed in a manifest or found
+  * under a directory, and prints a throughput summary.
+  *
+  * \param argc The number of arguments, counting the subcommand name
+  * \param argv An array of argument strings, starting with the subcommand name
+  * \return 0 on success, 1 on failure
+  */
+int cli_jobs(int argc, char **argv);
+
 /** Command Line Interface function for encryption and decryption.
   *
   * \param argc The number of arguments
   * \param argv An array of argument strings
   * \return 0 on success, 1 on failure
   */
-int cli(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Error: Invalid number of arguments.\n");
-        return 1;
-    }
-
-    const char *operation = argv[1];
-    const char *key = argv[2];
-    const char *message = argv[3];
-
-    if (strcmp(operation, "caesar-encrypt") == 0 || strcmp(operation, "caesar-decrypt") == 0) {
-        char *endptr;
-        int shift = strtol(key, &endptr, 10);
-        if (*endptr != '\0') {
-            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
-            return 1;
-        }
-
-        char output[256];
-        if (strcmp(operation, "caesar-encrypt") == 0) {
-            caesar_encrypt(shift, message, output);
-        } else {
-            caesar_decrypt(shift, message, output);
-        }
-        printf("%s\n", output);
-        return 0;
-
-    } else if (strcmp(operation, "vigenere-encrypt") == 0 || strcmp(operation, "vigenere-decrypt") == 0) {
-        char output[256];
-        if (strcmp(operation, "vigenere-encrypt") == 0) {
-            vigenere_encrypt('A', 'Z', key, message, output);
-        } else {
-            vigenere_decrypt('A', 'Z', key, message, output);
-        }
-        printf("%s\n", output);
-        return 0;
-
-    } else {
-        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
-        return 1;
-    }
-}
+int cli(int argc, char **argv);
 
 #endif
 // CRYPTO_H
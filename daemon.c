@@ -0,0 +1,909 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/** Responses are written once this many bytes are pending, even if more pipelined
+  * requests have already arrived.
+  */
+#define DAEMON_FLUSH_LEN (1 << 20)
+
+/** The smallest read attempted on a connection.
+  */
+#define DAEMON_READ_LEN (64 * 1024)
+
+/** Accepted connections waiting for a free worker.
+  */
+#define DAEMON_QUEUE_LEN 64
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+/** Grow `*buf` to hold at least `need` bytes.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int reserve(uint8_t **buf, size_t *cap, size_t need) {
+    if (*cap >= need) {
+        return 0;
+    }
+    size_t new_cap = *cap * 2 > need ? *cap * 2 : need;
+    uint8_t *new_buf = realloc(*buf, new_cap);
+    if (new_buf == NULL) {
+        return -1;
+    }
+    *buf = new_buf;
+    *cap = new_cap;
+    return 0;
+}
+
+static int send_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/** A compiled cipher held by the daemon's context cache.
+  *
+  * The fields after `ctx` identify the cipher; the Caesar operations ignore the key and
+  * the Vigenere operations ignore the shift, so those are stored as empty and 0.
+  */
+struct cached_ctx {
+    struct cipher_ctx ctx;
+    enum cipher_op op;
+    uint8_t low;
+    uint8_t high;
+    int shift;
+    uint8_t *key;
+    size_t key_len;
+    uint64_t hash;
+    unsigned long last_used;
+    int refs;
+    int cached;
+};
+
+/** A least-recently-used cache of compiled ciphers, shared by all workers.
+  *
+  * Entries in use by a request are never evicted. If every slot is in use, a new cipher
+  * is compiled for the request alone and freed as soon as it is released.
+  */
+struct ctx_cache {
+    pthread_mutex_t lock;
+    struct cached_ctx **entries;
+    size_t capacity;
+    size_t count;
+    unsigned long clock;
+};
+
+static uint64_t cache_hash(enum cipher_op op, uint8_t low, uint8_t high, int shift,
+                           const uint8_t *key, size_t key_len) {
+    uint64_t hash = 14695981039346656037u;
+    uint8_t fixed[7] = {
+        (uint8_t) op, low, high,
+        (uint8_t) (shift >> 24), (uint8_t) (shift >> 16), (uint8_t) (shift >> 8), (uint8_t) shift
+    };
+
+    for (size_t i = 0; i < sizeof(fixed); ++i) {
+        hash = (hash ^ fixed[i]) * 1099511628211u;
+    }
+    for (size_t i = 0; i < key_len; ++i) {
+        hash = (hash ^ key[i]) * 1099511628211u;
+    }
+    return hash;
+}
+
+static void cached_ctx_free(struct cached_ctx *entry) {
+    cipher_ctx_free(&entry->ctx);
+    free(entry->key);
+    free(entry);
+}
+
+/** Return the cached entry matching the given cipher, or NULL. The caller holds the lock.
+  */
+static struct cached_ctx *cache_find(struct ctx_cache *cache, uint64_t hash,
+                                     enum cipher_op op, uint8_t low, uint8_t high, int shift,
+                                     const uint8_t *key, size_t key_len) {
+    for (size_t i = 0; i < cache->count; ++i) {
+        struct cached_ctx *entry = cache->entries[i];
+        if (entry->hash == hash && entry->op == op && entry->low == low
+            && entry->high == high && entry->shift == shift && entry->key_len == key_len
+            && memcmp(entry->key, key, key_len) == 0) {
+            entry->refs++;
+            entry->last_used = ++cache->clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/** Return a compiled cipher for a request, from the cache if possible. The result must be
+  * passed to `ctx_cache_release` once the request is done with it.
+  *
+  * \return The entry, or NULL on failure (with `errno` set as by `cipher_ctx_init`)
+  */
+static struct cached_ctx *ctx_cache_acquire(struct ctx_cache *cache, enum cipher_op op,
+                                            uint8_t low, uint8_t high, int shift,
+                                            const uint8_t *key, size_t key_len) {
+    if (op == CAESAR_ENCRYPT || op == CAESAR_DECRYPT) {
+        key_len = 0;
+    } else {
+        shift = 0;
+    }
+    uint64_t hash = cache_hash(op, low, high, shift, key, key_len);
+
+    pthread_mutex_lock(&cache->lock);
+    struct cached_ctx *entry = cache_find(cache, hash, op, low, high, shift, key, key_len);
+    pthread_mutex_unlock(&cache->lock);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    /* Compile outside the lock, so that a long key does not stall the other workers. */
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->key = malloc(key_len > 0 ? key_len : 1);
+    if (entry->key == NULL) {
+        free(entry);
+        return NULL;
+    }
+    memcpy(entry->key, key, key_len);
+    if (cipher_ctx_init(&entry->ctx, op, (char) low, (char) high, shift, key, key_len) != 0) {
+        int saved_errno = errno;
+        free(entry->key);
+        free(entry);
+        errno = saved_errno;
+        return NULL;
+    }
+    entry->op = op;
+    entry->low = low;
+    entry->high = high;
+    entry->shift = shift;
+    entry->key_len = key_len;
+    entry->hash = hash;
+    entry->refs = 1;
+
+    pthread_mutex_lock(&cache->lock);
+    struct cached_ctx *existing = cache_find(cache, hash, op, low, high, shift, key, key_len);
+    if (existing != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        cached_ctx_free(entry);
+        return existing;
+    }
+    if (cache->count == cache->capacity) {
+        size_t victim = cache->count;
+        for (size_t i = 0; i < cache->count; ++i) {
+            if (cache->entries[i]->refs == 0
+                && (victim == cache->count
+                    || cache->entries[i]->last_used < cache->entries[victim]->last_used)) {
+                victim = i;
+            }
+        }
+        if (victim < cache->count) {
+            cached_ctx_free(cache->entries[victim]);
+            cache->entries[victim] = cache->entries[--cache->count];
+        }
+    }
+    if (cache->count < cache->capacity) {
+        cache->entries[cache->count++] = entry;
+        entry->cached = 1;
+        entry->last_used = ++cache->clock;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+static void ctx_cache_release(struct ctx_cache *cache, struct cached_ctx *entry) {
+    pthread_mutex_lock(&cache->lock);
+    int drop = --entry->refs == 0 && !entry->cached;
+    pthread_mutex_unlock(&cache->lock);
+    if (drop) {
+        cached_ctx_free(entry);
+    }
+}
+
+/** The state of a running daemon.
+  *
+  * Task 0 of the `run_parallel` call accepts connections into `queue`; every other task is
+  * a worker that serves one connection at a time, recording its socket in `active` so
+  * that it can be shut down when the daemon stops.
+  */
+struct server {
+    int listen_fd;
+    struct ctx_cache cache;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int queue[DAEMON_QUEUE_LEN];
+    size_t queue_head;
+    size_t queue_count;
+    int stopping;
+    int active[CIPHER_MAX_THREADS];
+};
+
+/** The buffers of one client connection.
+  */
+struct connection {
+    int fd;
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+};
+
+/** Carry out one request and append its response to `conn->out`.
+  *
+  * \param frame The request, after its length prefix
+  * \param frame_len The length of `frame`, at least `DAEMON_REQUEST_HEADER - 4`
+  * \return 0 on success, or -1 if the response cannot be buffered
+  */
+static int handle_request(struct server *server, struct connection *conn,
+                          const uint8_t *frame, size_t frame_len) {
+    uint32_t id = get_u32(frame);
+    uint8_t op = frame[4];
+    uint8_t low = frame[5];
+    uint8_t high = frame[6];
+    int shift = (int32_t) get_u32(frame + 8);
+    uint32_t key_index = get_u32(frame + 12);
+    size_t key_len = get_u32(frame + 16);
+    size_t header_len = DAEMON_REQUEST_HEADER - 4;
+    const uint8_t *key = frame + header_len;
+    size_t payload_len = key_len <= frame_len - header_len ? frame_len - header_len - key_len : 0;
+
+    if (reserve(&conn->out, &conn->out_cap,
+                conn->out_len + DAEMON_RESPONSE_HEADER + payload_len) != 0) {
+        return -1;
+    }
+    uint8_t *response = conn->out + conn->out_len;
+    uint32_t status = 0;
+
+    if (key_len > frame_len - header_len || op > VIGENERE_DECRYPT) {
+        status = EINVAL;
+    } else {
+        struct cached_ctx *entry = ctx_cache_acquire(&server->cache, (enum cipher_op) op,
+                                                     low, high, shift, key, key_len);
+        if (entry == NULL) {
+            status = (uint32_t) errno;
+        } else {
+            key_index = (uint32_t) cipher_ctx_apply(&entry->ctx, key_index, key + key_len,
+                                                    payload_len,
+                                                    response + DAEMON_RESPONSE_HEADER);
+            ctx_cache_release(&server->cache, entry);
+        }
+    }
+    if (status != 0) {
+        payload_len = 0;
+    }
+
+    put_u32(response, (uint32_t) (DAEMON_RESPONSE_HEADER - 4 + payload_len));
+    put_u32(response + 4, id);
+    put_u32(response + 8, status);
+    put_u32(response + 12, key_index);
+    conn->out_len += DAEMON_RESPONSE_HEADER + payload_len;
+    return 0;
+}
+
+static int flush_responses(struct connection *conn) {
+    int result = send_all(conn->fd, conn->out, conn->out_len);
+    conn->out_len = 0;
+    return result;
+}
+
+/** Answer requests on `fd` until the client closes it or breaks the protocol.
+  */
+static void serve_connection(struct server *server, int fd) {
+    struct connection conn = { .fd = fd };
+    size_t pos = 0;
+
+    for (;;) {
+        /* Answer every complete request already received before waiting for more, so a
+         * pipelined batch costs one write. */
+        while (conn.in_len - pos >= 4) {
+            size_t frame_len = get_u32(conn.in + pos);
+            if (frame_len < DAEMON_REQUEST_HEADER - 4 || frame_len > DAEMON_MAX_FRAME) {
+                TRACE(1, "closing connection %d: bad frame length %zu\n", fd, frame_len);
+                goto done;
+            }
+            if (conn.in_len - pos - 4 < frame_len) {
+                break;
+            }
+            if (handle_request(server, &conn, conn.in + pos + 4, frame_len) != 0) {
+                goto done;
+            }
+            pos += 4 + frame_len;
+            if (conn.out_len >= DAEMON_FLUSH_LEN && flush_responses(&conn) != 0) {
+                goto done;
+            }
+        }
+        if (flush_responses(&conn) != 0) {
+            goto done;
+        }
+
+        if (pos > 0) {
+            memmove(conn.in, conn.in + pos, conn.in_len - pos);
+            conn.in_len -= pos;
+            pos = 0;
+        }
+        size_t need = conn.in_len + DAEMON_READ_LEN;
+        if (conn.in_len >= 4 && 4 + (size_t) get_u32(conn.in) > need) {
+            need = 4 + (size_t) get_u32(conn.in);
+        }
+        if (reserve(&conn.in, &conn.in_cap, need) != 0) {
+            goto done;
+        }
+        ssize_t n = read(fd, conn.in + conn.in_len, conn.in_cap - conn.in_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        conn.in_len += (size_t) n;
+    }
+
+done:
+    free(conn.in);
+    free(conn.out);
+}
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig) {
+    (void) sig;
+    stop_requested = 1;
+}
+
+/** Accept connections into the queue until SIGINT or SIGTERM arrives, then shut down
+  * every connection so that the workers return.
+  */
+static void accept_connections(struct server *server) {
+    sigset_t wait_mask;
+    pthread_sigmask(SIG_SETMASK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    while (!stop_requested) {
+        pthread_mutex_lock(&server->lock);
+        int full = server->queue_count == DAEMON_QUEUE_LEN;
+        pthread_mutex_unlock(&server->lock);
+
+        /* The stop signals are blocked except inside ppoll, so one cannot slip in between
+         * the check above and the wait. While the queue is full, poll for nothing and
+         * re-check now and then. */
+        struct pollfd pfd = { .fd = server->listen_fd, .events = full ? 0 : POLLIN };
+        struct timespec timeout = { 0, 50 * 1000 * 1000 };
+        if (ppoll(&pfd, 1, full ? &timeout : NULL, &wait_mask) <= 0 || full) {
+            continue;
+        }
+
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "Error: accept: %s\n", strerror(errno));
+            }
+            continue;
+        }
+        TRACE(1, "accepted connection %d\n", fd);
+        pthread_mutex_lock(&server->lock);
+        server->queue[(server->queue_head + server->queue_count++) % DAEMON_QUEUE_LEN] = fd;
+        pthread_cond_signal(&server->changed);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    for (int i = 0; i < CIPHER_MAX_THREADS; ++i) {
+        if (server->active[i] >= 0) {
+            shutdown(server->active[i], SHUT_RDWR);
+        }
+    }
+    for (; server->queue_count > 0; --server->queue_count) {
+        close(server->queue[server->queue_head++ % DAEMON_QUEUE_LEN]);
+    }
+    pthread_cond_broadcast(&server->changed);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void server_task(void *arg, int index) {
+    struct server *server = arg;
+
+    if (index == 0) {
+        accept_connections(server);
+        return;
+    }
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_count == 0 && !server->stopping) {
+            pthread_cond_wait(&server->changed, &server->lock);
+        }
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+        int fd = server->queue[server->queue_head++ % DAEMON_QUEUE_LEN];
+        server->queue_count--;
+        server->active[index] = fd;
+        pthread_mutex_unlock(&server->lock);
+
+        serve_connection(server, fd);
+
+        pthread_mutex_lock(&server->lock);
+        server->active[index] = -1;
+        pthread_mutex_unlock(&server->lock);
+        close(fd);
+    }
+}
+
+/** Fill in the address of the Unix domain socket at `path`.
+  *
+  * \return 0 on success, or -1 if the path is too long (with `errno` set)
+  */
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/** Create a non-blocking socket listening at `path`, replacing a stale socket left by a
+  * daemon that did not shut down cleanly.
+  *
+  * \return The socket, or -1 on failure (with `errno` set)
+  */
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (unix_address(path, &addr) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(fd, SOMAXCONN) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+/** Options for `cli serve` and `cli client`.
+  */
+struct daemon_options {
+    const char *socket_path;
+    const char *metrics;
+    int num_workers;
+    int cache_size;
+    const char *positional[2];
+    int num_positional;
+    const char **messages;
+    int num_messages;
+};
+
+static void daemon_usage(void) {
+    fprintf(stderr,
+            "Usage: cli serve --socket PATH [--workers N] [--cache N] [--metrics FMT]\n"
+            "       cli client --socket PATH <operation> <key> [message...]\n"
+            "\n"
+            "serve answers cipher requests on the Unix domain socket PATH until it receives\n"
+            "SIGINT or SIGTERM. client sends one request per message (pipelined on a single\n"
+            "connection) and prints each result; with no message, stdin is sent as one\n"
+            "request and the result is written to stdout.\n"
+            "\n"
+            "Options:\n"
+            "  --socket PATH   the socket to listen on or connect to\n"
+            "  --workers N     serve up to N connections at once (default one per CPU)\n"
+            "  --cache N       keep up to N compiled keys (default 64)\n"
+            "  --metrics FMT   count bytes and request latencies, and print them to stderr\n"
+            "                  in prometheus or json format on SIGUSR1 and on exit\n");
+}
+
+/** Parse the arguments of `cli serve` (if `client` is 0) or `cli client` (otherwise).
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int parse_daemon_options(int argc, char **argv, int client,
+                                struct daemon_options *opts) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->num_workers = cpus < 1 ? 1 : cpus > CIPHER_MAX_THREADS - 1 ? CIPHER_MAX_THREADS - 1 : (int) cpus;
+    opts->cache_size = 64;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            if (!client) {
+                fprintf(stderr, "Error: Invalid number of arguments.\n");
+                return 1;
+            }
+            if (opts->num_positional < 2) {
+                opts->positional[opts->num_positional++] = arg;
+            } else {
+                if (opts->messages == NULL) {
+                    opts->messages = (const char **) argv + i;
+                }
+                opts->num_messages++;
+            }
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (strcmp(arg, "--socket") == 0) {
+            opts->socket_path = value;
+        } else if (!client && strcmp(arg, "--workers") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 1, CIPHER_MAX_THREADS - 1, &n) != 0) {
+                return 1;
+            }
+            opts->num_workers = (int) n;
+        } else if (!client && strcmp(arg, "--metrics") == 0) {
+            enum metrics_format format;
+            if (metrics_format_from_name(value, &format) != 0) {
+                fprintf(stderr, "Error: Invalid value for --metrics.\n");
+                return 1;
+            }
+            opts->metrics = value;
+        } else if (!client && strcmp(arg, "--cache") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 0, 4096, &n) != 0) {
+                return 1;
+            }
+            opts->cache_size = (int) n;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s.\n", arg);
+            return 1;
+        }
+    }
+    if (opts->socket_path == NULL) {
+        fprintf(stderr, "Error: --socket is required.\n");
+        return 1;
+    }
+    if (client && opts->num_positional < 2) {
+        fprintf(stderr, "Error: Invalid number of arguments.\n");
+        return 1;
+    }
+    if (client && opts->messages != NULL && opts->num_messages != argc - (opts->messages - (const char **) argv)) {
+        fprintf(stderr, "Error: Options must come before the messages.\n");
+        return 1;
+    }
+    return 0;
+}
+
+int cli_serve(int argc, char **argv) {
+    struct daemon_options opts;
+    struct server server;
+    struct sigaction action;
+    sigset_t signals;
+    sigset_t old_mask;
+
+    if (parse_daemon_options(argc, argv, 0, &opts) != 0) {
+        daemon_usage();
+        return 1;
+    }
+
+    /* Before any other thread exists, so that all of them block the dump signal. */
+    enum metrics_format metrics_format;
+    if (opts.metrics != NULL) {
+        metrics_format_from_name(opts.metrics, &metrics_format);
+        metrics_enable(1);
+        if (metrics_watch_signal(SIGUSR1, STDERR_FILENO, metrics_format) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.listen_fd = listen_unix(opts.socket_path);
+    if (server.listen_fd < 0) {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", opts.socket_path, strerror(errno));
+        return 1;
+    }
+    server.cache.capacity = (size_t) opts.cache_size;
+    server.cache.entries = malloc(sizeof(*server.cache.entries) * (opts.cache_size + 1));
+    if (server.cache.entries == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        close(server.listen_fd);
+        unlink(opts.socket_path);
+        return 1;
+    }
+    pthread_mutex_init(&server.cache.lock, NULL);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.changed, NULL);
+    for (int i = 0; i < CIPHER_MAX_THREADS; ++i) {
+        server.active[i] = -1;
+    }
+
+    /* The workers inherit a mask blocking the stop signals, so that they are only ever
+     * delivered to the accepting thread while it waits in ppoll. */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_mask);
+
+    TRACE(1, "serving on %s with %d workers\n", opts.socket_path, opts.num_workers);
+    run_parallel(opts.num_workers + 1, server_task, &server);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    close(server.listen_fd);
+    unlink(opts.socket_path);
+    for (size_t i = 0; i < server.cache.count; ++i) {
+        cached_ctx_free(server.cache.entries[i]);
+    }
+    free(server.cache.entries);
+    pthread_mutex_destroy(&server.cache.lock);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.changed);
+    if (opts.metrics != NULL) {
+        metrics_dump(STDERR_FILENO, metrics_format);
+    }
+    return 0;
+}
+
+/** Append a request frame to `*buf`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int append_request(uint8_t **buf, size_t *len, size_t *cap, uint32_t id,
+                          enum cipher_op op, int shift, const char *key,
+                          const uint8_t *payload, size_t payload_len) {
+    size_t key_len = op == VIGENERE_ENCRYPT || op == VIGENERE_DECRYPT ? strlen(key) : 0;
+    size_t frame_len = DAEMON_REQUEST_HEADER - 4 + key_len + payload_len;
+
+    if (frame_len > DAEMON_MAX_FRAME) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (reserve(buf, cap, *len + 4 + frame_len) != 0) {
+        return -1;
+    }
+    uint8_t *p = *buf + *len;
+    put_u32(p, (uint32_t) frame_len);
+    put_u32(p + 4, id);
+    p[8] = (uint8_t) op;
+    p[9] = 'A';
+    p[10] = 'Z';
+    p[11] = 0;
+    put_u32(p + 12, (uint32_t) shift);
+    put_u32(p + 16, 0);
+    put_u32(p + 20, (uint32_t) key_len);
+    memcpy(p + DAEMON_REQUEST_HEADER, key, key_len);
+    memcpy(p + DAEMON_REQUEST_HEADER + key_len, payload, payload_len);
+    *len += 4 + frame_len;
+    return 0;
+}
+
+/** Read all of stdin into a newly allocated buffer.
+  *
+  * \return The buffer, or NULL on failure (with `errno` set)
+  */
+static uint8_t *read_stdin(size_t *len) {
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+
+    *len = 0;
+    for (;;) {
+        if (reserve(&buf, &cap, *len + DAEMON_READ_LEN) != 0) {
+            free(buf);
+            return NULL;
+        }
+        ssize_t n = read(STDIN_FILENO, buf + *len, cap - *len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int saved_errno = errno;
+            free(buf);
+            errno = saved_errno;
+            return NULL;
+        }
+        if (n == 0) {
+            return buf;
+        }
+        *len += (size_t) n;
+    }
+}
+
+/** Send `requests` on `fd` while reading the responses, so that neither side can block
+  * the other with a full socket buffer, and print each response payload.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int exchange(int fd, const uint8_t *requests, size_t requests_len, int num_requests,
+                    int newline) {
+    uint8_t *in = NULL;
+    size_t in_len = 0;
+    size_t in_cap = 0;
+    size_t sent = 0;
+    int received = 0;
+    int result = 0;
+
+    while (received < num_requests && result == 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN | (sent < requests_len ? POLLOUT : 0) };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            result = 1;
+            break;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, requests + sent, requests_len - sent,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "Error: %s\n", strerror(errno));
+                result = 1;
+                break;
+            }
+            sent += n > 0 ? (size_t) n : 0;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        if (reserve(&in, &in_cap, in_len + DAEMON_READ_LEN) != 0) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            result = 1;
+            break;
+        }
+        ssize_t n = recv(fd, in + in_len, in_cap - in_len, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "Error: Connection closed by the daemon.\n");
+            result = 1;
+            break;
+        }
+        in_len += (size_t) n;
+
+        size_t pos = 0;
+        while (in_len - pos >= DAEMON_RESPONSE_HEADER
+               && in_len - pos - 4 >= get_u32(in + pos)) {
+            size_t payload_len = get_u32(in + pos) - (DAEMON_RESPONSE_HEADER - 4);
+            uint32_t status = get_u32(in + pos + 8);
+            if (status != 0) {
+                fprintf(stderr, "Error: Request %u failed: %s\n", get_u32(in + pos + 4),
+                        strerror((int) status));
+                result = 1;
+            } else {
+                fwrite(in + pos + DAEMON_RESPONSE_HEADER, 1, payload_len, stdout);
+                if (newline) {
+                    putchar('\n');
+                }
+            }
+            pos += 4 + get_u32(in + pos);
+            received++;
+        }
+        if (pos > 0) {
+            memmove(in, in + pos, in_len - pos);
+            in_len -= pos;
+        }
+    }
+    free(in);
+    return result;
+}
+
+int cli_client(int argc, char **argv) {
+    struct daemon_options opts;
+    struct sockaddr_un addr;
+    enum cipher_op op;
+    int shift = 0;
+
+    if (parse_daemon_options(argc, argv, 1, &opts) != 0) {
+        daemon_usage();
+        return 1;
+    }
+    const char *key = opts.positional[1];
+    if (cipher_op_from_name(opts.positional[0], &op) != 0) {
+        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
+        return 1;
+    }
+    if (op == CAESAR_ENCRYPT || op == CAESAR_DECRYPT) {
+        char *endptr;
+        shift = strtol(key, &endptr, 10);
+        if (*endptr != '\0') {
+            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
+            return 1;
+        }
+    }
+
+    uint8_t *requests = NULL;
+    size_t requests_len = 0;
+    size_t requests_cap = 0;
+    int num_requests = opts.num_messages > 0 ? opts.num_messages : 1;
+    int failed = 0;
+    if (opts.num_messages == 0) {
+        size_t len;
+        uint8_t *input = read_stdin(&len);
+        failed = input == NULL
+                 || append_request(&requests, &requests_len, &requests_cap, 0, op, shift, key,
+                                   input, len) != 0;
+        free(input);
+    }
+    for (int i = 0; i < opts.num_messages && !failed; ++i) {
+        failed = append_request(&requests, &requests_len, &requests_cap, (uint32_t) i, op,
+                                shift, key, (const uint8_t *) opts.messages[i],
+                                strlen(opts.messages[i])) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        free(requests);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || unix_address(opts.socket_path, &addr) != 0
+        || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Cannot connect to %s: %s\n", opts.socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(requests);
+        return 1;
+    }
+
+    int result = exchange(fd, requests, requests_len, num_requests, opts.num_messages > 0);
+    close(fd);
+    free(requests);
+    return result;
+}
@@ -1,7 +1,199 @@
+#include "crypto.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+
+/** Reduce a Caesar shift to the equivalent shift in the range [0, range_size).
+  */
+static int normalize_shift(int shift, int range_size) {
+    shift %= range_size;
+    return shift < 0 ? shift + range_size : shift;
+}
+
+/** Return the offset within the range by which a Vigenere key character shifts the
+  * characters it encrypts.
+  */
+static int vigenere_key_offset(uint8_t key_char, uint8_t low, int range_size) {
+    return normalize_shift(key_char - low, range_size);
+}
+
+/** Record a call of `op` that started at `start` and wrote `len` bytes to `out`.
+  */
+static void record_call(enum cipher_op op, char range_low, char range_high,
+                        const uint8_t *out, size_t len, uint64_t start) {
+    uint64_t elapsed = metrics_clock() - start;
+    metrics_record(op, len, count_in_range(range_low, range_high, out, len), elapsed);
+}
+
+/** Shared implementation of `caesar_encrypt_buf` and `caesar_decrypt_buf`.
+  */
+static void caesar_buf(char range_low, char range_high, int shift,
+                       const uint8_t *in, size_t len, uint8_t *out) {
+    uint8_t low = (uint8_t) range_low;
+    uint8_t high = (uint8_t) range_high;
+    int range_size = high - low + 1;
+    shift = normalize_shift(shift, range_size);
+    TRACE(1, "caesar shift %d over range %d..%d, %zu bytes\n", shift, low, high, len);
+    if (shift == 0) {
+        if (in != out) {
+            memcpy(out, in, len);
+        }
+        return;
+    }
+
+    size_t i = caesar_simd(low, range_size, shift, in, len, out);
+    const struct fixed_range *fixed = fixed_range_find(range_low, range_high);
+    if (fixed != NULL) {
+        fixed->caesar(shift, in + i, len - i, out + i);
+        return;
+    }
+    for (; i < len; ++i) {
+        uint8_t c = in[i];
+        if (c >= low && c <= high) {
+            out[i] = low + (c - low + shift) % range_size;
+        } else {
+            out[i] = c;
+        }
+        TRACE(2, "character %d -> %d\n", c, out[i]);
+    }
+}
+
+void caesar_encrypt_buf(char range_low, char range_high, int shift,
+                        const uint8_t *in, size_t len, uint8_t *out) {
+    uint64_t start = metrics_enabled() ? metrics_clock() : 0;
+    caesar_buf(range_low, range_high, shift, in, len, out);
+    if (start != 0) {
+        record_call(CAESAR_ENCRYPT, range_low, range_high, out, len, start);
+    }
+}
+
+void caesar_decrypt_buf(char range_low, char range_high, int shift,
+                        const uint8_t *in, size_t len, uint8_t *out) {
+    uint64_t start = metrics_enabled() ? metrics_clock() : 0;
+    int range_size = (uint8_t) range_high - (uint8_t) range_low + 1;
+    caesar_buf(range_low, range_high, range_size - normalize_shift(shift, range_size),
+               in, len, out);
+    if (start != 0) {
+        record_call(CAESAR_DECRYPT, range_low, range_high, out, len, start);
+    }
+}
+
+size_t vigenere_schedule(char range_low, char range_high, const uint8_t *key,
+                         size_t key_len, int decrypt, uint8_t *shifts) {
+    uint8_t low = (uint8_t) range_low;
+    int range_size = (uint8_t) range_high - low + 1;
+    size_t period = key_len * ((VIGENERE_SIMD_MIN_PERIOD + key_len - 1) / key_len);
+
+    for (size_t i = 0; i < period + VIGENERE_SIMD_OVERREAD; ++i) {
+        int k = vigenere_key_offset(key[i % key_len], low, range_size);
+        shifts[i] = (uint8_t) (decrypt && k != 0 ? range_size - k : k);
+    }
+    return period;
+}
+
+/** Inputs shorter than this are not worth building a `vigenere_schedule` for.
+  */
+#define VIGENERE_SIMD_THRESHOLD 256
+
+/** Keys up to this length have their schedule built on the stack.
+  */
+#define VIGENERE_STACK_KEY_LEN 1024
+
+/** Shared implementation of `vigenere_encrypt_buf` and `vigenere_decrypt_buf`.
+  */
+static size_t vigenere_buf(char range_low, char range_high, const uint8_t *key,
+                           size_t key_len, size_t key_index,
+                           const uint8_t *in, size_t len, uint8_t *out, int decrypt) {
+    uint8_t low = (uint8_t) range_low;
+    uint8_t high = (uint8_t) range_high;
+    int range_size = high - low + 1;
+    size_t i = 0;
+    key_index %= key_len;
+    TRACE(1, "vigenere %s over range %d..%d, key length %zu from index %zu, %zu bytes\n",
+          decrypt ? "decrypt" : "encrypt", low, high, key_len, key_index, len);
+
+    if (len >= VIGENERE_SIMD_THRESHOLD && simd_level() >= SIMD_SSSE3) {
+        uint8_t stack_shifts[VIGENERE_SCHEDULE_LEN(VIGENERE_STACK_KEY_LEN)];
+        uint8_t *shifts = stack_shifts;
+        if (key_len > VIGENERE_STACK_KEY_LEN) {
+            shifts = malloc(VIGENERE_SCHEDULE_LEN(key_len));
+        }
+        if (shifts != NULL) {
+            size_t period = vigenere_schedule(range_low, range_high, key, key_len, decrypt,
+                                              shifts);
+            size_t pos = key_index;
+            i = vigenere_simd(low, range_size, shifts, period, &pos, in, len, out);
+            key_index = pos % key_len;
+            if (shifts != stack_shifts) {
+                free(shifts);
+            }
+        }
+    }
+
+    const struct fixed_range *fixed = fixed_range_find(range_low, range_high);
+    if (fixed != NULL) {
+        return (decrypt ? fixed->vigenere_decrypt : fixed->vigenere_encrypt)(
+            key, key_len, key_index, in + i, len - i, out + i);
+    }
+    for (; i < len; ++i) {
+        uint8_t c = in[i];
+        if (c >= low && c <= high) {
+            int k = vigenere_key_offset(key[key_index], low, range_size);
+            if (decrypt) {
+                out[i] = low + (c - low + range_size - k) % range_size;
+            } else {
+                out[i] = low + (c - low + k) % range_size;
+            }
+            if (++key_index == key_len) {
+                key_index = 0;
+            }
+        } else {
+            out[i] = c;
+        }
+        TRACE(2, "character %d -> %d, key index %zu\n", c, out[i], key_index);
+    }
+    return key_index;
+}
+
+size_t vigenere_encrypt_buf(char range_low, char range_high, const uint8_t *key,
+                            size_t key_len, size_t key_index,
+                            const uint8_t *in, size_t len, uint8_t *out) {
+    uint64_t start = metrics_enabled() ? metrics_clock() : 0;
+    key_index = vigenere_buf(range_low, range_high, key, key_len, key_index, in, len, out, 0);
+    if (start != 0) {
+        record_call(VIGENERE_ENCRYPT, range_low, range_high, out, len, start);
+    }
+    return key_index;
+}
+
+size_t vigenere_decrypt_buf(char range_low, char range_high, const uint8_t *key,
+                            size_t key_len, size_t key_index,
+                            const uint8_t *in, size_t len, uint8_t *out) {
+    uint64_t start = metrics_enabled() ? metrics_clock() : 0;
+    key_index = vigenere_buf(range_low, range_high, key, key_len, key_index, in, len, out, 1);
+    if (start != 0) {
+        record_call(VIGENERE_DECRYPT, range_low, range_high, out, len, start);
+    }
+    return key_index;
+}
+
+size_t count_in_range(char range_low, char range_high, const uint8_t *in, size_t len) {
+    uint8_t low = (uint8_t) range_low;
+    uint8_t high = (uint8_t) range_high;
+    size_t count = 0;
+
+    for (size_t i = count_in_range_simd(low, high - low + 1, in, len, &count); i < len; ++i) {
+        count += in[i] >= low && in[i] <= high;
+    }
+    return count;
+}
 
 /** Encrypt a given plaintext using the Caesar cipher, with the specified shift.
   *
@@ -14,17 +206,10 @@
   *           plain_text (including the terminating null character).
   */
 void caesar_encrypt(char range_low, char range_high, int shift, const char *plain_text, char *cipher_text) {
-    int i;
-    int range_size = range_high - range_low + 1;
-    for (i = 0; plain_text[i] != '\0'; ++i) {
-        char plain_char = plain_text[i];
-        if (plain_char >= range_low && plain_char <= range_high) {
-            cipher_text[i] = range_low + (plain_char - range_low + shift) % range_size;
-        } else {
-            cipher_text[i] = plain_char;
-        }
-    }
-    cipher_text[i] = '\0';
+    size_t len = strlen(plain_text);
+    caesar_encrypt_buf(range_low, range_high, shift, (const uint8_t *) plain_text, len,
+                       (uint8_t *) cipher_text);
+    cipher_text[len] = '\0';
 }
 
 /** Decrypt a given ciphertext using the Caesar cipher, with the specified shift.
@@ -38,7 +223,10 @@ void caesar_encrypt(char range_low, char range_high, int shift, const char *plai
   *           cipher_text (including the terminating null character).
   */
 void caesar_decrypt(char range_low, char range_high, int shift, const char *cipher_text, char *plain_text) {
-    caesar_encrypt(range_low, range_high, (range_high - range_low + 1) - shift, cipher_text, plain_text);
+    size_t len = strlen(cipher_text);
+    caesar_decrypt_buf(range_low, range_high, shift, (const uint8_t *) cipher_text, len,
+                       (uint8_t *) plain_text);
+    plain_text[len] = '\0';
 }
 
 /** Encrypt a given plaintext using the Vigenere cipher, using a specified key, where the
@@ -56,22 +244,10 @@ void caesar_decrypt(char range_low, char range_high, int shift, const char *ciph
   */
 void vigenere_encrypt(char range_low, char range_high, const char *key,
                       const char *plain_text, char *cipher_text) {
-    int key_len = strlen(key);
-    int key_index = 0;
-
-    for (int i = 0; plain_text[i] != '\0'; ++i) {
-        char plain_char = plain_text[i];
-
-        if (plain_char >= range_low && plain_char <= range_high) {
-            char key_char = key[key_index % key_len];
-            cipher_text[i] = range_low + (plain_char - range_low + key_char - range_low) % (range_high - range_low + 1);
-            key_index++;
-        } else {
-            cipher_text[i] = plain_char;
-        }
-    }
-
-    cipher_text[strlen(plain_text)] = '\0';
+    size_t len = strlen(plain_text);
+    vigenere_encrypt_buf(range_low, range_high, (const uint8_t *) key, strlen(key), 0,
+                         (const uint8_t *) plain_text, len, (uint8_t *) cipher_text);
+    cipher_text[len] = '\0';
 }
 
 /** Decrypt a given ciphertext using the Vigenere cipher, using a specified key, where the
@@ -89,239 +265,670 @@ void vigenere_encrypt(char range_low, char range_high, const char *key,
   */
 void vigenere_decrypt(char range_low, char range_high, const char *key,
                       const char *cipher_text, char *plain_text) {
-    int key_len = strlen(key);
-    int key_index = 0;
+    size_t len = strlen(cipher_text);
+    vigenere_decrypt_buf(range_low, range_high, (const uint8_t *) key, strlen(key), 0,
+                         (const uint8_t *) cipher_text, len, (uint8_t *) plain_text);
+    plain_text[len] = '\0';
+}
 
-    for (int i = 0; cipher_text[i] != '\0'; ++i) {
-        char cipher_char = cipher_text[i];
+/** Options collected from the command line by `parse_cli_options`.
+  */
+struct cli_options {
+    const char *operation;
+    const char *key;
+    const char *message;
+    const char *in_path;
+    const char *out_path;
+    const char *ranges;
+    const char *key_policy;
+    const char *async_mode;
+    const char *index_path;
+    const char *metrics;
+    const char *key_mode;
+    long index_interval;
+    long offset;
+    long length;
+    int use_range;
+    int queue_depth;
+    int num_threads;
+    int use_mmap;
+    int filter_key;
+    int sparse;
+};
+
+/** Return nonzero if `opts` selects a key that never repeats, read by a `keystream`.
+  */
+static int uses_keystream(const struct cli_options *opts) {
+    return opts->key_mode != NULL && strcmp(opts->key_mode, "repeating") != 0;
+}
 
-        if (cipher_char >= range_low && cipher_char <= range_high) {
-            char key_char = key[key_index % key_len];
-            plain_text[i] = range_low + (cipher_char - key_char + (range_high - range_low + 1)) % (range_high - range_low + 1);
-            key_index++;
-        } else {
-            plain_text[i] = cipher_char;
+/** Print a short usage summary to stderr.
+  */
+static void cli_usage(void) {
+    fprintf(stderr,
+            "Usage: cli [options] <operation> <key> [message]\n"
+            "       cli caesar-crack [options] [message]\n"
+            "       cli vigenere-crack [options] [message]\n"
+            "       cli bench [options]\n"
+            "       cli verify [options]\n"
+            "       cli jobs [options] <operation> <key>\n"
+            "       cli serve --socket PATH [options]\n"
+            "       cli client --socket PATH <operation> <key> [message...]\n"
+            "\n"
+            "If no message is given, input is read from stdin (or --in) and the result is\n"
+            "written to stdout (or --out).\n"
+            "\n"
+            "With --key-mode running, <key> names a file (or pipe) holding a key at least as\n"
+            "long as the input; with --key-mode autokey, it is the primer of a key that\n"
+            "continues with the plaintext.\n"
+            "\n"
+            "Options:\n"
+            "  --in PATH      read input from PATH instead of stdin\n"
+            "  --out PATH     write output to PATH instead of stdout\n"
+            "  --threads N    encrypt using N threads (0 for one per CPU)\n"
+            "  --mmap         memory-map --in and --out instead of reading and writing\n"
+            "                 (if they name the same file it is transformed in place)\n"
+            "  --ranges LIST  rotate each of a comma-separated list of ranges, such as\n"
+            "                 A-Z,a-z,0-9 (in any order), within itself (default A-Z)\n"
+            "  --key-policy P with --ranges, advance the Vigenere key on a character of any\n"
+            "                 range (shared, the default) or separately per range (per-range)\n"
+            "  --async MODE   overlap reading, encrypting and writing using io_uring,\n"
+            "                 threads, or io_uring where available (auto), and report MB/s\n"
+            "  --queue-depth N\n"
+            "                 with --async, keep N buffers in flight (default 8)\n"
+            "  --index PATH   write a seek index of the input to PATH; with --offset or\n"
+            "                 --length, read it to start decrypting near --offset\n"
+            "  --index-interval N\n"
+            "                 with --index, place a checkpoint every N bytes (default 1 MiB)\n"
+            "  --offset N     transform --in only from byte N\n"
+            "  --length N     transform at most N bytes of --in\n"
+            "  --metrics FMT  count bytes and call latencies, and print them to stderr in\n"
+            "                 prometheus or json format on exit and on SIGUSR1\n"
+            "  --key-mode M   use the Vigenere key as given (repeating, the default), read it\n"
+            "                 from a file (running), or extend it with the plaintext (autokey)\n"
+            "  --filter-key   with --key-mode running, skip key characters outside the range\n"
+            "  --sparse       copy 64-byte blocks with nothing to encrypt straight through,\n"
+            "                 for UTF-8 or binary input (ranges must be within ASCII, so\n"
+            "                 multibyte UTF-8 characters are never altered)\n");
+}
+
+int parse_long_option(const char *option, const char *value, long min, long max,
+                      long *result) {
+    char *endptr;
+    errno = 0;
+    *result = strtol(value, &endptr, 10);
+    if (*value == '\0' || *endptr != '\0' || errno != 0 || *result < min || *result > max) {
+        fprintf(stderr, "Error: Invalid value for %s. Must be an integer from %ld to %ld.\n",
+                option, min, max);
+        return 1;
+    }
+    return 0;
+}
+
+/** Options that are followed by a value.
+  */
+static const char *const value_options[] = {
+    "--in", "--out", "--threads", "--ranges", "--key-policy", "--async",
+    "--queue-depth", "--index", "--index-interval", "--offset", "--length",
+    "--metrics", "--key-mode", NULL
+};
+
+/** Return nonzero if `option` is followed by a value.
+  */
+static int is_value_option(const char *option) {
+    for (const char *const *name = value_options; *name != NULL; ++name) {
+        if (strcmp(option, *name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Record the value of an option listed in `value_options`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int set_value_option(struct cli_options *opts, const char *option, const char *value) {
+    long n;
+
+    if (strcmp(option, "--in") == 0) {
+        opts->in_path = value;
+    } else if (strcmp(option, "--out") == 0) {
+        opts->out_path = value;
+    } else if (strcmp(option, "--ranges") == 0) {
+        opts->ranges = value;
+    } else if (strcmp(option, "--key-policy") == 0) {
+        if (strcmp(value, "shared") != 0 && strcmp(value, "per-range") != 0) {
+            fprintf(stderr, "Error: Invalid value for --key-policy. Must be shared or per-range.\n");
+            return 1;
+        }
+        opts->key_policy = value;
+    } else if (strcmp(option, "--async") == 0) {
+        if (strcmp(value, "auto") != 0 && strcmp(value, "io_uring") != 0
+            && strcmp(value, "threads") != 0) {
+            fprintf(stderr, "Error: Invalid value for --async. Must be auto, io_uring or threads.\n");
+            return 1;
+        }
+        opts->async_mode = value;
+    } else if (strcmp(option, "--queue-depth") == 0) {
+        if (parse_long_option(option, value, 2, CIPHER_ASYNC_MAX_DEPTH, &n) != 0) {
+            return 1;
+        }
+        opts->queue_depth = (int) n;
+    } else if (strcmp(option, "--metrics") == 0) {
+        enum metrics_format format;
+        if (metrics_format_from_name(value, &format) != 0) {
+            fprintf(stderr, "Error: Invalid value for --metrics. Must be prometheus or json.\n");
+            return 1;
+        }
+        opts->metrics = value;
+    } else if (strcmp(option, "--key-mode") == 0) {
+        if (strcmp(value, "repeating") != 0 && strcmp(value, "running") != 0
+            && strcmp(value, "autokey") != 0) {
+            fprintf(stderr, "Error: Invalid value for --key-mode. Must be repeating, running or autokey.\n");
+            return 1;
+        }
+        opts->key_mode = value;
+    } else if (strcmp(option, "--index") == 0) {
+        opts->index_path = value;
+    } else if (strcmp(option, "--index-interval") == 0) {
+        return parse_long_option(option, value, 1, LONG_MAX, &opts->index_interval);
+    } else if (strcmp(option, "--offset") == 0 || strcmp(option, "--length") == 0) {
+        opts->use_range = 1;
+        return parse_long_option(option, value, 0, LONG_MAX,
+                                 option[2] == 'o' ? &opts->offset : &opts->length);
+    } else if (strcmp(option, "--threads") == 0) {
+        if (parse_long_option(option, value, 0, CIPHER_MAX_THREADS, &n) != 0) {
+            return 1;
         }
+        if (n == 0) {
+            n = sysconf(_SC_NPROCESSORS_ONLN);
+            n = n < 1 ? 1 : n > CIPHER_MAX_THREADS ? CIPHER_MAX_THREADS : n;
+        }
+        opts->num_threads = (int) n;
     }
+    return 0;
+}
 
-    plain_text[strlen(cipher_text)] = '\0';
+/** Record an option that takes no value.
+  *
+  * \return 0 on success, or -1 if `option` is not a known flag
+  */
+static int set_flag_option(struct cli_options *opts, const char *option) {
+    if (strcmp(option, "--mmap") == 0) {
+        opts->use_mmap = 1;
+    } else if (strcmp(option, "--filter-key") == 0) {
+        opts->filter_key = 1;
+    } else if (strcmp(option, "--sparse") == 0) {
+        opts->sparse = 1;
+    } else {
+        return -1;
+    }
+    return 0;
 }
 
-/** Command Line Interface function for encryption and decryption.
+/** Split the command line into positional arguments and options.
+  *
+  * Options may appear before, between or after the positional arguments.
   *
   * \param argc The number of arguments
   * \param argv An array of argument strings
+  * \param opts Receives the parsed options
   * \return 0 on success, 1 on failure
   */
-int cli(int argc, char **argv) {
-    if (argc != 4) {
+static int parse_cli_options(int argc, char **argv, struct cli_options *opts) {
+    const char *positional[3];
+    int num_positional = 0;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->num_threads = 1;
+    opts->queue_depth = 8;
+    opts->index_interval = SEEK_INDEX_INTERVAL;
+    opts->length = -1;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (is_value_option(arg)) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+                return 1;
+            }
+            if (set_value_option(opts, arg, argv[++i]) != 0) {
+                return 1;
+            }
+        } else if (strncmp(arg, "--", 2) == 0) {
+            if (set_flag_option(opts, arg) != 0) {
+                fprintf(stderr, "Error: Unknown option %s.\n", arg);
+                return 1;
+            }
+        } else if (num_positional < 3) {
+            positional[num_positional++] = arg;
+        } else {
+            fprintf(stderr, "Error: Invalid number of arguments.\n");
+            return 1;
+        }
+    }
+
+    if (num_positional < 2) {
         fprintf(stderr, "Error: Invalid number of arguments.\n");
         return 1;
     }
+    opts->operation = positional[0];
+    opts->key = positional[1];
+    opts->message = num_positional == 3 ? positional[2] : NULL;
+    if (opts->message != NULL && (opts->in_path != NULL || opts->out_path != NULL)) {
+        fprintf(stderr, "Error: --in and --out cannot be combined with a message argument.\n");
+        return 1;
+    }
+    if (opts->use_mmap && (opts->message != NULL || opts->in_path == NULL || opts->out_path == NULL
+                           || strcmp(opts->in_path, "-") == 0 || strcmp(opts->out_path, "-") == 0)) {
+        fprintf(stderr, "Error: --mmap requires --in and --out to name files.\n");
+        return 1;
+    }
+    if (opts->ranges != NULL && (opts->use_mmap || opts->num_threads != 1)) {
+        fprintf(stderr, "Error: --ranges cannot be combined with --mmap or --threads.\n");
+        return 1;
+    }
+    if (opts->async_mode != NULL && (opts->use_mmap || opts->message != NULL)) {
+        fprintf(stderr, "Error: --async cannot be combined with --mmap or a message argument.\n");
+        return 1;
+    }
+    if (opts->use_range && (opts->message != NULL || opts->in_path == NULL
+                            || strcmp(opts->in_path, "-") == 0)) {
+        fprintf(stderr, "Error: --offset and --length require --in to name a file.\n");
+        return 1;
+    }
+    if (opts->use_range && (opts->use_mmap || opts->async_mode != NULL || opts->ranges != NULL)) {
+        fprintf(stderr, "Error: --offset and --length cannot be combined with --mmap, --async or --ranges.\n");
+        return 1;
+    }
+    if (opts->index_path != NULL && (opts->use_mmap || opts->ranges != NULL || opts->message != NULL)) {
+        fprintf(stderr, "Error: --index cannot be combined with --mmap, --ranges or a message argument.\n");
+        return 1;
+    }
+    if (opts->key_policy != NULL && opts->ranges == NULL) {
+        fprintf(stderr, "Error: --key-policy requires --ranges.\n");
+        return 1;
+    }
+    if (uses_keystream(opts) && (opts->ranges != NULL || opts->use_mmap || opts->num_threads != 1
+                                 || opts->async_mode != NULL || opts->index_path != NULL
+                                 || opts->use_range || opts->sparse)) {
+        fprintf(stderr, "Error: --key-mode %s cannot be combined with --ranges, --mmap, --threads, --async, --index, --offset, --length or --sparse.\n",
+                opts->key_mode);
+        return 1;
+    }
+    if (opts->filter_key && (opts->key_mode == NULL || strcmp(opts->key_mode, "running") != 0)) {
+        fprintf(stderr, "Error: --filter-key requires --key-mode running.\n");
+        return 1;
+    }
+    return 0;
+}
 
-    const char *operation = argv[1];
-    const char *key = argv[2];
-    const char *message = argv[3];
-
-    if (strcmp(operation, "caesar-encrypt") == 0 || strcmp(operation, "caesar-decrypt") == 0) {
-        char *endptr;
-        int shift = strtol(key, &endptr, 10);
-        if (*endptr != '\0') {
-            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
+/** Open the input and output files named in `opts`, defaulting to stdin and stdout.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int cli_open_files(const struct cli_options *opts, int *in_fd, int *out_fd) {
+    *in_fd = STDIN_FILENO;
+    *out_fd = STDOUT_FILENO;
+
+    if (opts->in_path != NULL && strcmp(opts->in_path, "-") != 0) {
+        *in_fd = open(opts->in_path, O_RDONLY);
+        if (*in_fd < 0) {
+            fprintf(stderr, "Error: Cannot open %s: %s\n", opts->in_path, strerror(errno));
             return 1;
         }
-
-        char output[256];
-        if (strcmp(operation, "caesar-encrypt") == 0) {
-            caesar_encrypt('A', 'Z', shift, message, output);
-        } else {
-            caesar_decrypt('A', 'Z', shift, message, output);
-        }
-        printf("%s\n", output);
-        return 0;
-
-    } else if (strcmp(operation, "vigenere-encrypt") == 0 || strcmp(operation, "vigenere-decrypt") == 0) {
-        char output[256];
-        if (strcmp(operation, "vigenere-encrypt") == 0) {
-            vigenere_encrypt('A', 'Z', key, message, output);
-        } else {
-            vigenere_decrypt('A', 'Z', key, message, output);
+    }
+    if (opts->out_path != NULL && strcmp(opts->out_path, "-") != 0) {
+        *out_fd = open(opts->out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (*out_fd < 0) {
+            fprintf(stderr, "Error: Cannot open %s: %s\n", opts->out_path, strerror(errno));
+            if (*in_fd != STDIN_FILENO) {
+                close(*in_fd);
+            }
+            return 1;
         }
-        printf("%s\n", output);
-        return 0;
-
-    } else {
-        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
-        return 1;
     }
+    return 0;
 }
 
-// Example main function for testing
-int main(int argc, char **argv) {
-    return cli(argc, argv);
+/** Close the files opened by `cli_open_files`.
+  *
+  * \return 0 on success, 1 if the output could not be written (after printing an error)
+  */
+static int cli_close_files(const struct cli_options *opts, int in_fd, int out_fd) {
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    if (out_fd != STDOUT_FILENO && close(out_fd) != 0) {
+        fprintf(stderr, "Error: Cannot write %s: %s\n", opts->out_path, strerror(errno));
+        return 1;
+    }
+    return 0;
 }
-#include "crypto.h"
-#include <stdio.h> 
-#include <string.h>
-#include <assert.h>
-
-
-/****************************************************************/
-void caesar_encrypt(char range_low, char range_high, int key, const char * plain_text, char * cipher_text){
-    /* Check which char are within the range 
-
-        Eliminate chars less than the low range && Eliminate chars more than the high range 
-
-        For loop to check characters are in the low range or high range 
-
 
-    Storing the key value 
-        
-        Character Array of keys is stored as their ASCII value 
-        
-    Switch characters 
-
-        Convert ASCII char into integer char 
-
-        Difference between the two characters 
-
-        Add difference to create the cipher text 
-
-    Build plain text and store the plain text 
-
-        Add the character to the buffers
-    
-    
-    */
-    int len = 0; 
-    int low_value = (int) range_low;
-    int high_value = (int) range_high; 
-
-    printf("ASCII value of range_low: %i \n", low_value);
-
-    printf("ASCII value of range_high: %i \n", high_value);
-
-    
+/** Run `stream` over the input and output files named in `opts`, defaulting to stdin and
+  * stdout, or over just the part of the input selected by `--offset` and `--length`.
+  * With `--index` the seek index is written afterwards, or read first to find where in
+  * the input the selected part can start being read.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int cli_stream(const struct cli_options *opts, struct cipher_stream *stream) {
+    int in_fd;
+    int out_fd;
+    if (cli_open_files(opts, &in_fd, &out_fd) != 0) {
+        return 1;
+    }
 
-    for (int i = 0; i < strlen(plain_text); ++i){
-        printf("Character : %c \n", plain_text[i]);
-    
-        int char_val = (int) plain_text[i];
-        printf("Character value %d \n", char_val); 
-        
-        if (char_val < low_value || char_val > high_value){
-            printf("Character is out of range \n");
-            printf("Cipher char %c \n",(char) char_val );
-            cipher_text[i] = (char) char_val;
-        }else{ 
-            char cipher_char = (char) (char_val + key);
-            printf("Cipher character: %c \n", cipher_char);
-            cipher_text[i] = cipher_char;
+    int result = 0;
+    struct seek_index index;
+    if (opts->index_path != NULL && opts->use_range) {
+        if (seek_index_load(&index, opts->index_path) != 0) {
+            fprintf(stderr, "Error: Cannot read %s: %s\n", opts->index_path, strerror(errno));
+            result = 1;
         }
+    } else if (opts->index_path != NULL) {
+        if (seek_index_init(&index, (char) stream->ctx->low, (char) stream->ctx->high,
+                            (uint64_t) opts->index_interval, stream->key_index) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            result = 1;
+        }
+        stream->index = &index;
+    }
 
-
-
+    if (result != 0) {
+        /* The index could not be set up. */
+    } else if (opts->use_range) {
+        uint64_t length = opts->length < 0 ? UINT64_MAX : (uint64_t) opts->length;
+        if (cipher_decrypt_range(stream->ctx, opts->index_path != NULL ? &index : NULL, in_fd,
+                                 (uint64_t) opts->offset, length, out_fd,
+                                 stream->num_threads) != 0) {
+            if (errno == EINVAL && opts->index_path != NULL) {
+                fprintf(stderr, "Error: %s is not an index of %s.\n", opts->index_path,
+                        opts->in_path);
+            } else {
+                fprintf(stderr, "Error: %s\n", strerror(errno));
+            }
+            result = 1;
+        }
+    } else if (opts->async_mode != NULL) {
+        enum async_backend backend = strcmp(opts->async_mode, "io_uring") == 0 ? ASYNC_IO_URING
+                                     : strcmp(opts->async_mode, "threads") == 0 ? ASYNC_THREADS
+                                     : ASYNC_AUTO;
+        struct cipher_async_stats stats;
+        if (cipher_async_fd(stream, in_fd, out_fd, opts->queue_depth, backend, &stats) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            result = 1;
+        } else {
+            fprintf(stderr, "%llu bytes in %.3f s (%.1f MB/s) using %s\n",
+                    (unsigned long long) stats.bytes, stats.seconds,
+                    stats.seconds > 0 ? stats.bytes / stats.seconds / 1e6 : 0.0,
+                    stats.used_io_uring ? "io_uring" : "threads");
+        }
+    } else if (cipher_stream_fd(stream, in_fd, out_fd) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        result = 1;
+    }
+    if (result == 0 && stream->index != NULL && seek_index_save(&index, opts->index_path) != 0) {
+        fprintf(stderr, "Error: Cannot write %s: %s\n", opts->index_path, strerror(errno));
+        result = 1;
+    }
+    if (opts->index_path != NULL) {
+        seek_index_free(&index);
+        stream->index = NULL;
+    }
+    if (cli_close_files(opts, in_fd, out_fd) != 0) {
+        result = 1;
     }
+    return result;
+}
 
-        
+static const char *const cipher_op_names[] = {
+    [CAESAR_ENCRYPT] = "caesar-encrypt",
+    [CAESAR_DECRYPT] = "caesar-decrypt",
+    [VIGENERE_ENCRYPT] = "vigenere-encrypt",
+    [VIGENERE_DECRYPT] = "vigenere-decrypt",
+};
 
+const char *cipher_op_name(enum cipher_op op) {
+    return cipher_op_names[op];
+}
 
-} 
+int cipher_op_from_name(const char *name, enum cipher_op *op) {
+    for (size_t i = 0; i < sizeof(cipher_op_names) / sizeof(cipher_op_names[0]); ++i) {
+        if (strcmp(name, cipher_op_names[i]) == 0) {
+            *op = (enum cipher_op) i;
+            return 0;
+        }
+    }
+    return -1;
+}
 
+/** Look up the operation named `operation` and, for the Caesar operations, parse `key`
+  * as its shift.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int cli_parse_key(const char *operation, const char *key, enum cipher_op *op,
+                         int *shift) {
+    *shift = 0;
+    if (cipher_op_from_name(operation, op) != 0) {
+        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
+        return 1;
+    }
+    if (*op == CAESAR_ENCRYPT || *op == CAESAR_DECRYPT) {
+        char *endptr;
+        *shift = strtol(key, &endptr, 10);
+        if (*endptr != '\0') {
+            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
+            return 1;
+        }
+    } else if (*key == '\0') {
+        fprintf(stderr, "Error: Invalid key for Vigenere cipher. Must not be empty.\n");
+        return 1;
+    }
+    return 0;
+}
 
+/** Compile the cipher named by `operation`, with the given key, into `ctx`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int cli_make_ctx(const char *operation, const char *key, struct cipher_ctx *ctx) {
+    enum cipher_op op;
+    int shift;
 
+    if (cli_parse_key(operation, key, &op, &shift) != 0) {
+        return 1;
+    }
+    if (cipher_ctx_init(ctx, op, 'A', 'Z', shift, (const uint8_t *) key, strlen(key)) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
 
-void caesar_decrypt(char range_low, char range_high, int key, const char *cipher_text, char *plain_text) {
-    int len = strlen(cipher_text);
-    int range_size = range_high - range_low + 1;
-    printf("decrypting");
-    
+/** Compile the cipher described by `opts` over the ranges in `opts->ranges` into `multi`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int cli_make_multi(const struct cli_options *opts, struct multi_ctx *multi) {
+    struct cipher_range ranges[CIPHER_MAX_RANGES];
+    enum cipher_op op;
+    int shift;
 
-    for (int i = 0; i < len; ++i) {
-        printf("Character in cipher text %c \n", cipher_text[i]);
+    if (cli_parse_key(opts->operation, opts->key, &op, &shift) != 0) {
+        return 1;
+    }
+    int num_ranges = parse_ranges(opts->ranges, ranges);
+    if (num_ranges < 0) {
+        fprintf(stderr, "Error: Invalid value for --ranges. Must be a list such as A-Z,a-z,0-9.\n");
+        return 1;
+    }
+    for (int r = 0; r < num_ranges && opts->sparse; ++r) {
+        if ((uint8_t) ranges[r].low >= 0x80 || (uint8_t) ranges[r].high >= 0x80) {
+            fprintf(stderr, "Error: --sparse requires ranges within ASCII.\n");
+            return 1;
+        }
+    }
+    enum key_policy policy = opts->key_policy != NULL && strcmp(opts->key_policy, "per-range") == 0
+                             ? KEY_PER_RANGE : KEY_SHARED;
+    if (multi_ctx_init(multi, op, ranges, num_ranges, shift, (const uint8_t *) opts->key,
+                       strlen(opts->key), policy) != 0) {
+        if (errno == EINVAL) {
+            fprintf(stderr, "Error: Invalid value for --ranges. Each range must go from low to high (a-z, not z-a), and the ranges must not overlap.\n");
+        } else {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+        }
+        return 1;
+    }
+    return 0;
+}
 
-        int char_val = (int) cipher_text[i];
+/** Encrypt or decrypt with the repeating key given on the command line, either the
+  * message argument or the input and output files named in `opts`.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int cli_cipher(const struct cli_options *opts) {
+    struct cipher_ctx ctx;
+    struct multi_ctx multi;
+    int use_multi = opts->ranges != NULL;
+    if (use_multi ? cli_make_multi(opts, &multi) != 0
+                  : cli_make_ctx(opts->operation, opts->key, &ctx) != 0) {
+        return 1;
+    }
+    if (use_multi) {
+        multi.sparse = opts->sparse;
+    } else {
+        ctx.sparse = opts->sparse;
+    }
 
-        if (char_val < range_low || char_val > range_high) {
-            plain_text[i] = cipher_text[i];
+    int result = 0;
+    if (opts->use_mmap) {
+        if (cipher_mmap_file(&ctx, opts->in_path, opts->out_path, opts->num_threads) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            result = 1;
+        }
+    } else if (opts->message == NULL) {
+        struct cipher_stream stream;
+        if (use_multi) {
+            cipher_stream_init_multi(&stream, &multi);
         } else {
-            int new_char_val = char_val - key;
-            while (new_char_val < range_low) {
-                new_char_val = range_high - (range_low - new_char_val - 1);
+            cipher_stream_init(&stream, &ctx);
+            stream.num_threads = opts->num_threads;
+        }
+        result = cli_stream(opts, &stream);
+    } else {
+        size_t len = strlen(opts->message);
+        char *output = malloc(len + 1);
+        if (output == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            result = 1;
+        } else {
+            if (use_multi) {
+                struct cipher_stream stream;
+                cipher_stream_init_multi(&stream, &multi);
+                cipher_stream_update(&stream, (const uint8_t *) opts->message, len,
+                                     (uint8_t *) output);
+            } else {
+                cipher_ctx_apply_parallel(&ctx, 0, (const uint8_t *) opts->message, len,
+                                          (uint8_t *) output, opts->num_threads);
             }
-            plain_text[i] = (char) new_char_val;
+            output[len] = '\0';
+            printf("%s\n", output);
+            free(output);
         }
-        printf("Character in plain text %c \n", plain_text[i]);
     }
-    plain_text[len] = '\0'; // Null-terminate the plain_text
+
+    if (use_multi) {
+        multi_ctx_free(&multi);
+    } else {
+        cipher_ctx_free(&ctx);
+    }
+    return result;
 }
 
-// Helper function to perform Vigenere encryption on a single character
-char vigenere_encrypt_char(char plain_char, char key_char, char range_low, char range_high) {
-    int range_size = range_high - range_low + 1;
-    return range_low + (plain_char - range_low + key_char - range_low) % range_size;
+/** Describe the failure of a `keystream` function, which sets `errno` to `ENODATA` when
+  * the running key is too short.
+  */
+static const char *keystream_error(void) {
+    return errno == ENODATA ? "The key is shorter than the input." : strerror(errno);
 }
 
-void vigenere_encrypt(char range_low, char range_high, const char *key,
-                      const char *plain_text, char *cipher_text) {
-    // Get the length of the key
-    int key_len = strlen(key);
-    // Initialize the index for the key
-    int key_index = 0;
-    
-    // Iterate over each character in the plain_text
-    for (int i = 0; plain_text[i] != '\0'; ++i) {
-        char plain_char = plain_text[i];
-        
-        // Check if the character is within the specified range
-        if (plain_char >= range_low && plain_char <= range_high) {
-            // Get the current key character
-            char key_char = key[key_index % key_len];
-            // Encrypt the character and store it in cipher_text
-            cipher_text[i] = vigenere_encrypt_char(plain_char, key_char, range_low, range_high);
-            // Move to the next key character
-            key_index++;
-        } else {
-            // Copy the character as is if it's out of range
-            cipher_text[i] = plain_char;
+/** Encrypt or decrypt with the running key or autokey selected by `--key-mode`, either the
+  * message argument or the input and output files named in `opts`.
+  *
+  * \return 0 on success, 1 on failure
+  */
+static int cli_keystream(const struct cli_options *opts) {
+    enum cipher_op op;
+    int shift;
+
+    if (cli_parse_key(opts->operation, opts->key, &op, &shift) != 0) {
+        return 1;
+    }
+    if (op != VIGENERE_ENCRYPT && op != VIGENERE_DECRYPT) {
+        fprintf(stderr, "Error: --key-mode %s requires a Vigenere operation.\n", opts->key_mode);
+        return 1;
+    }
+
+    struct keystream ks;
+    int key_fd = -1;
+    if (strcmp(opts->key_mode, "running") == 0) {
+        key_fd = open(opts->key, O_RDONLY);
+        if (key_fd < 0) {
+            fprintf(stderr, "Error: Cannot open %s: %s\n", opts->key, strerror(errno));
+            return 1;
         }
+        if (keystream_init_running(&ks, op, 'A', 'Z', key_fd, opts->filter_key) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            close(key_fd);
+            return 1;
+        }
+    } else if (keystream_init_autokey(&ks, op, 'A', 'Z', (const uint8_t *) opts->key,
+                                      strlen(opts->key)) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        return 1;
     }
-    
-    // Null-terminate the cipher_text
-    cipher_text[strlen(plain_text)] = '\0';
-}
-char vigenere_decrypt_char(char cipher_char, char key_char, char range_low, char range_high) {
-    int range_size = range_high - range_low + 1;
-    return range_low + (cipher_char - key_char + range_size) % range_size;
-}
 
-void vigenere_decrypt(char range_low, char range_high, const char *key,
-                      const char *cipher_text, char *plain_text) {
-    // Get the length of the key
-    int key_len = strlen(key);
-    // Initialize the index for the key
-    int key_index = 0;
-    
-    // Iterate over each character in the cipher_text
-    for (int i = 0; cipher_text[i] != '\0'; ++i) {
-        char cipher_char = cipher_text[i];
-        
-        // Check if the character is within the specified range
-        if (cipher_char >= range_low && cipher_char <= range_high) {
-            // Get the current key character
-            char key_char = key[key_index % key_len];
-            // Decrypt the character and store it in plain_text
-            plain_text[i] = vigenere_decrypt_char(cipher_char, key_char, range_low, range_high);
-            // Move to the next key character
-            key_index++;
+    int result = 0;
+    if (opts->message != NULL) {
+        size_t len = strlen(opts->message);
+        char *output = malloc(len + 1);
+        if (output == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            result = 1;
+        } else if (keystream_update(&ks, (const uint8_t *) opts->message, len,
+                                    (uint8_t *) output) != 0) {
+            fprintf(stderr, "Error: %s\n", keystream_error());
+            result = 1;
+        } else {
+            output[len] = '\0';
+            printf("%s\n", output);
+        }
+        free(output);
+    } else {
+        int in_fd;
+        int out_fd;
+        if (cli_open_files(opts, &in_fd, &out_fd) != 0) {
+            result = 1;
         } else {
-            // Copy the character as is if it's out of range
-            plain_text[i] = cipher_char;
+            if (keystream_fd(&ks, in_fd, out_fd) != 0) {
+                fprintf(stderr, "Error: %s\n", keystream_error());
+                result = 1;
+            }
+            if (cli_close_files(opts, in_fd, out_fd) != 0) {
+                result = 1;
+            }
         }
     }
-    
-    // Null-terminate the plain_text
-    plain_text[strlen(cipher_text)] = '\0';
+
+    keystream_free(&ks);
+    if (key_fd >= 0) {
+        close(key_fd);
+    }
+    return result;
 }
 
 /** Command Line Interface function for encryption and decryption.
@@ -331,54 +938,52 @@ void vigenere_decrypt(char range_low, char range_high, const char *key,
   * \return 0 on success, 1 on failure
   */
 int cli(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Error: Invalid number of arguments.\n");
-        return 1;
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return cli_bench(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0) {
+        return cli_verify(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "caesar-crack") == 0) {
+        return cli_caesar_crack(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "vigenere-crack") == 0) {
+        return cli_vigenere_crack(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "jobs") == 0) {
+        return cli_jobs(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        return cli_serve(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "client") == 0) {
+        return cli_client(argc - 1, argv + 1);
     }
 
-    const char *operation = argv[1];
-    const char *key = argv[2];
-    const char *message = argv[3];
+    struct cli_options opts;
+    if (parse_cli_options(argc, argv, &opts) != 0) {
+        cli_usage();
+        return 1;
+    }
 
-    if (strcmp(operation, "caesar-encrypt") == 0 || strcmp(operation, "caesar-decrypt") == 0) {
-        char *endptr;
-        int shift = strtol(key, &endptr, 10);
-        if (*endptr != '\0') {
-            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
+    enum metrics_format metrics_format;
+    if (opts.metrics != NULL) {
+        metrics_format_from_name(opts.metrics, &metrics_format);
+        metrics_enable(1);
+        if (metrics_watch_signal(SIGUSR1, STDERR_FILENO, metrics_format) != 0) {
+            fprintf(stderr, "Error: %s\n", strerror(errno));
             return 1;
         }
+    }
 
-        char output[256];
-        if (strcmp(operation, "caesar-encrypt") == 0) {
-            caesar_encrypt(shift, message, output);
-        } else {
-            caesar_decrypt(shift, message, output);
-        }
-        printf("%s\n", output);
-        return 0;
-
-    } else if (strcmp(operation, "vigenere-encrypt") == 0 || strcmp(operation, "vigenere-decrypt") == 0) {
-        char output[256];
-        if (strcmp(operation, "vigenere-encrypt") == 0) {
-            vigenere_encrypt('A', 'Z', key, message, output);
-        } else {
-            vigenere_decrypt('A', 'Z', key, message, output);
-        }
-        printf("%s\n", output);
-        return 0;
-
-    } else {
-        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
-        return 1;
+    int result = uses_keystream(&opts) ? cli_keystream(&opts) : cli_cipher(&opts);
+    if (opts.metrics != NULL) {
+        metrics_dump(STDERR_FILENO, metrics_format);
     }
+    return result;
 }
 
-int main(){ 
-    char plain_text[] = "HELLOWORLD";
-    char cipher_text[sizeof(plain_text)] = {0};
-    caesar_encrypt('A', 'Z', 3, plain_text, cipher_text);
-    char* expected_cipher_text = "KHOORZRUOG";
-    //assert(strcmp(cipher_text, expected_cipher_text) == 0);
-    char plain_text2[sizeof(cipher_text)] = {0};
-    caesar_decrypt('A', 'Z', 3, cipher_text, plain_text2);
-}
\ No newline at end of file
+// Example main function for testing
+int main(int argc, char **argv) {
+    return cli(argc, argv);
+}
@@ -0,0 +1,93 @@
+#include "crypto.h"
+
+/** Caesar kernel for the range `low`..`high`, for `0 <= shift < high - low + 1`.
+  *
+  * Always inlined into the wrappers defined by `FIXED_RANGE`, where `low` and `high` are
+  * constants, so the range test and wrap-around reduce to immediate compares and the
+  * loop vectorises.
+  */
+static inline __attribute__((always_inline))
+void fixed_caesar(uint8_t low, uint8_t high, int shift, const uint8_t *in, size_t len,
+                  uint8_t *out) {
+    const int range_size = high - low + 1;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t t = (uint8_t) (in[i] - low);
+        uint8_t r = (uint8_t) (t + shift);
+        r = r >= range_size ? (uint8_t) (r - range_size) : r;
+        out[i] = t < range_size ? (uint8_t) (low + r) : in[i];
+    }
+}
+
+/** Vigenere kernel for the range `low`..`high`, with the same contract as
+  * `vigenere_encrypt_buf` (or `vigenere_decrypt_buf` if `decrypt` is nonzero) except that
+  * `key_index` must already be less than `key_len`.
+  *
+  * As with `fixed_caesar`, every use of the range size is a constant after inlining, so
+  * the reduction of each key character is a multiply rather than a division.
+  */
+static inline __attribute__((always_inline))
+size_t fixed_vigenere(uint8_t low, uint8_t high, const uint8_t *key, size_t key_len,
+                      size_t key_index, const uint8_t *in, size_t len, uint8_t *out,
+                      int decrypt) {
+    const int range_size = high - low + 1;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = in[i];
+        uint8_t t = (uint8_t) (c - low);
+        if (t >= range_size) {
+            out[i] = c;
+            continue;
+        }
+        int k = (key[key_index] - low) % range_size;
+        k += k < 0 ? range_size : 0;
+        if (decrypt && k != 0) {
+            k = range_size - k;
+        }
+        int r = t + k;
+        r -= r >= range_size ? range_size : 0;
+        out[i] = (uint8_t) (low + r);
+        key_index = key_index + 1 == key_len ? 0 : key_index + 1;
+    }
+    return key_index;
+}
+
+/** Define the kernels of a fixed range, named after `name`.
+  */
+#define FIXED_RANGE(name, low, high)                                                       \
+    static void caesar_##name(int shift, const uint8_t *in, size_t len, uint8_t *out) {   \
+        fixed_caesar(low, high, shift, in, len, out);                                      \
+    }                                                                                      \
+    static size_t vigenere_encrypt_##name(const uint8_t *key, size_t key_len,              \
+                                          size_t key_index, const uint8_t *in,             \
+                                          size_t len, uint8_t *out) {                      \
+        return fixed_vigenere(low, high, key, key_len, key_index, in, len, out, 0);        \
+    }                                                                                      \
+    static size_t vigenere_decrypt_##name(const uint8_t *key, size_t key_len,              \
+                                          size_t key_index, const uint8_t *in,             \
+                                          size_t len, uint8_t *out) {                      \
+        return fixed_vigenere(low, high, key, key_len, key_index, in, len, out, 1);        \
+    }
+
+FIXED_RANGE(upper, 'A', 'Z')
+FIXED_RANGE(lower, 'a', 'z')
+FIXED_RANGE(printable, ' ', '~')
+
+#define FIXED_RANGE_ENTRY(name, low, high) \
+    { low, high, caesar_##name, vigenere_encrypt_##name, vigenere_decrypt_##name }
+
+static const struct fixed_range fixed_ranges[] = {
+    FIXED_RANGE_ENTRY(upper, 'A', 'Z'),
+    FIXED_RANGE_ENTRY(lower, 'a', 'z'),
+    FIXED_RANGE_ENTRY(printable, ' ', '~'),
+};
+
+const struct fixed_range *fixed_range_find(char range_low, char range_high) {
+    for (size_t i = 0; i < sizeof(fixed_ranges) / sizeof(fixed_ranges[0]); ++i) {
+        if (fixed_ranges[i].low == (uint8_t) range_low
+            && fixed_ranges[i].high == (uint8_t) range_high) {
+            return &fixed_ranges[i];
+        }
+    }
+    return NULL;
+}
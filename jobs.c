@@ -0,0 +1,694 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include "trace.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** One chunk of one file, and the unit of work handed between threads.
+  */
+struct job_task {
+    size_t job;
+    off_t offset;
+    size_t len;
+    size_t count;
+    size_t key_index;
+};
+
+/** A worker's queue of tasks. The owner takes tasks from the tail and other workers steal
+  * from the head, so an idle thread picks up the work furthest from what the owner is
+  * doing. `slots[head..tail)` holds indices into `job_run.tasks`.
+  */
+struct job_deque {
+    pthread_mutex_t lock;
+    size_t *slots;
+    size_t head;
+    size_t tail;
+};
+
+/** The shared state of a `cipher_run_jobs` call.
+  */
+struct job_run {
+    const struct cipher_ctx *ctx;
+    struct cipher_job *jobs;
+    struct job_task *tasks;
+    size_t num_tasks;
+    size_t chunk_size;
+    struct job_deque deques[CIPHER_MAX_THREADS];
+    int num_workers;
+    int counting;
+    pthread_mutex_t error_lock;
+};
+
+static void job_failed(struct job_run *run, size_t job, int error) {
+    pthread_mutex_lock(&run->error_lock);
+    if (run->jobs[job].error == 0) {
+        run->jobs[job].error = error;
+    }
+    pthread_mutex_unlock(&run->error_lock);
+}
+
+/** Take the next task for worker `self`, from its own deque if possible and otherwise by
+  * stealing from the others in turn.
+  *
+  * \return 1 if a task was taken, or 0 if there is no work left
+  */
+static int next_task(struct job_run *run, int self, size_t *task) {
+    struct job_deque *own = &run->deques[self];
+
+    pthread_mutex_lock(&own->lock);
+    int found = own->head < own->tail;
+    if (found) {
+        *task = own->slots[--own->tail];
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    /* Tasks never create tasks, so one sweep finding nothing means the round is over. */
+    for (int i = 1; i < run->num_workers && !found; ++i) {
+        struct job_deque *victim = &run->deques[(self + i) % run->num_workers];
+        pthread_mutex_lock(&victim->lock);
+        found = victim->head < victim->tail;
+        if (found) {
+            *task = victim->slots[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return found;
+}
+
+static int pread_all(int fd, uint8_t *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            /* The file shrank after it was planned. */
+            errno = n == 0 ? EIO : errno;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const uint8_t *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+        offset += n;
+    }
+    return 0;
+}
+
+/** Count the in-range bytes of a task's chunk (in the counting round) or transform it (in
+  * the apply round), using `buf` of `chunk_size` bytes.
+  */
+static void run_task(struct job_run *run, struct job_task *task, uint8_t *buf) {
+    struct cipher_job *job = &run->jobs[task->job];
+    int fd = open(job->in_path, O_RDONLY);
+
+    if (fd < 0 || pread_all(fd, buf, task->len, task->offset) != 0) {
+        job_failed(run, task->job, errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    close(fd);
+
+    if (run->counting) {
+        task->count = count_in_range((char) run->ctx->low, (char) run->ctx->high, buf,
+                                     task->len);
+        return;
+    }
+    cipher_ctx_apply(run->ctx, task->key_index, buf, task->len, buf);
+    fd = open(job->out_path, O_WRONLY);
+    if (fd < 0 || pwrite_all(fd, buf, task->len, task->offset) != 0) {
+        job_failed(run, task->job, errno);
+    }
+    if (fd >= 0 && close(fd) != 0) {
+        job_failed(run, task->job, errno);
+    }
+}
+
+static void job_worker(void *arg, int index) {
+    struct job_run *run = arg;
+    uint8_t *buf = malloc(run->chunk_size);
+    size_t task;
+
+    while (next_task(run, index, &task)) {
+        if (buf == NULL) {
+            job_failed(run, run->tasks[task].job, ENOMEM);
+            continue;
+        }
+        run_task(run, &run->tasks[task], buf);
+    }
+    free(buf);
+}
+
+/** Deal the tasks selected by `include` round-robin into the workers' deques, so that the
+  * chunks of one large file start out spread across every worker, and run the round.
+  */
+static void run_round(struct job_run *run, const char *include) {
+    size_t dealt = 0;
+
+    for (int w = 0; w < run->num_workers; ++w) {
+        run->deques[w].head = run->deques[w].tail = 0;
+    }
+    for (size_t t = 0; t < run->num_tasks; ++t) {
+        if (include == NULL || include[t]) {
+            struct job_deque *deque = &run->deques[dealt++ % run->num_workers];
+            deque->slots[deque->tail++] = t;
+        }
+    }
+    TRACE(1, "%s %zu tasks on %d workers\n", run->counting ? "counting" : "applying", dealt,
+          run->num_workers);
+    run_parallel(run->num_workers, job_worker, run);
+}
+
+/** Stat a job's input and create its output at the same size, leaving an output that is
+  * the input file itself untouched.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int plan_job(struct cipher_job *job) {
+    struct stat in_stat;
+    struct stat out_stat;
+
+    if (stat(job->in_path, &in_stat) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(in_stat.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    job->size = (uint64_t) in_stat.st_size;
+
+    int fd = open(job->out_path, O_WRONLY | O_CREAT, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+    int same = fstat(fd, &out_stat) == 0 && out_stat.st_dev == in_stat.st_dev
+               && out_stat.st_ino == in_stat.st_ino;
+    if (!same && ftruncate(fd, in_stat.st_size) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return close(fd);
+}
+
+int cipher_run_jobs(const struct cipher_ctx *ctx, struct cipher_job *jobs, size_t num_jobs,
+                    int chain_keys, size_t chunk_size, int num_threads) {
+    struct job_run run;
+    int vigenere = ctx->op == VIGENERE_ENCRYPT || ctx->op == VIGENERE_DECRYPT;
+
+    if (chunk_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&run, 0, sizeof(run));
+    run.ctx = ctx;
+    run.jobs = jobs;
+    run.chunk_size = chunk_size;
+    run.num_workers = num_threads < 1 ? 1 : num_threads > CIPHER_MAX_THREADS ? CIPHER_MAX_THREADS : num_threads;
+    pthread_mutex_init(&run.error_lock, NULL);
+
+    size_t num_tasks = 0;
+    for (size_t j = 0; j < num_jobs; ++j) {
+        jobs[j].error = plan_job(&jobs[j]) != 0 ? errno : 0;
+        if (jobs[j].error == 0) {
+            num_tasks += (size_t) ((jobs[j].size + chunk_size - 1) / chunk_size);
+        }
+    }
+
+    run.tasks = malloc(sizeof(*run.tasks) * (num_tasks + 1));
+    char *include = calloc(num_tasks + 1, 1);
+    int failed = run.tasks == NULL || include == NULL;
+    for (int w = 0; w < run.num_workers && !failed; ++w) {
+        pthread_mutex_init(&run.deques[w].lock, NULL);
+        run.deques[w].slots = malloc(sizeof(size_t) * (num_tasks / run.num_workers + 1));
+        failed = run.deques[w].slots == NULL;
+    }
+    if (failed) {
+        for (int w = 0; w < run.num_workers; ++w) {
+            free(run.deques[w].slots);
+        }
+        free(run.tasks);
+        free(include);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* The key index of a Vigenere chunk depends on how many in-range bytes come before it,
+     * so chunks that do not start a file at a known index are counted in a first round. */
+    int need_counts = 0;
+    for (size_t j = 0; j < num_jobs; ++j) {
+        if (jobs[j].error != 0) {
+            continue;
+        }
+        for (uint64_t offset = 0; offset < jobs[j].size; offset += chunk_size) {
+            struct job_task *task = &run.tasks[run.num_tasks];
+            task->job = j;
+            task->offset = (off_t) offset;
+            task->count = 0;
+            task->len = jobs[j].size - offset < chunk_size ? (size_t) (jobs[j].size - offset) : chunk_size;
+            include[run.num_tasks++] = vigenere && (chain_keys || offset + task->len < jobs[j].size);
+            need_counts |= include[run.num_tasks - 1];
+        }
+    }
+    if (need_counts) {
+        run.counting = 1;
+        run_round(&run, include);
+        run.counting = 0;
+    }
+
+    /* A chained key cannot be continued past a file that failed, since where it reached
+     * is unknown, so the files after one are cancelled rather than given a wrong key. */
+    size_t key_index = num_jobs > 0 ? jobs[0].key_index : 0;
+    int broken = 0;
+    size_t t = 0;
+    for (size_t j = 0; j < num_jobs; ++j) {
+        if (!chain_keys) {
+            key_index = jobs[j].key_index;
+        } else if (broken && jobs[j].error == 0) {
+            jobs[j].error = ECANCELED;
+        }
+        broken |= chain_keys && vigenere && jobs[j].error != 0;
+        for (; t < run.num_tasks && run.tasks[t].job == j; ++t) {
+            run.tasks[t].key_index = vigenere ? key_index % ctx->key_len : 0;
+            key_index = vigenere ? (key_index + run.tasks[t].count) % ctx->key_len : 0;
+            include[t] = jobs[j].error == 0;
+        }
+    }
+    run_round(&run, include);
+
+    int result = 0;
+    for (size_t j = 0; j < num_jobs; ++j) {
+        if (jobs[j].error != 0 && result == 0) {
+            errno = jobs[j].error;
+            result = -1;
+        }
+    }
+    for (int w = 0; w < run.num_workers; ++w) {
+        pthread_mutex_destroy(&run.deques[w].lock);
+        free(run.deques[w].slots);
+    }
+    pthread_mutex_destroy(&run.error_lock);
+    free(run.tasks);
+    free(include);
+    return result;
+}
+
+/** A growable list of jobs, with the path strings it owns.
+  */
+struct job_list {
+    struct cipher_job *jobs;
+    size_t count;
+    size_t capacity;
+};
+
+/** Append a job, taking ownership of the two paths.
+  *
+  * \return 0 on success, or -1 on failure (with both paths freed)
+  */
+static int add_job(struct job_list *list, char *in_path, char *out_path, size_t key_index) {
+    if (in_path == NULL || out_path == NULL) {
+        free(in_path);
+        free(out_path);
+        return -1;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        struct cipher_job *jobs = realloc(list->jobs, sizeof(*jobs) * capacity);
+        if (jobs == NULL) {
+            free(in_path);
+            free(out_path);
+            return -1;
+        }
+        list->jobs = jobs;
+        list->capacity = capacity;
+    }
+    struct cipher_job *job = &list->jobs[list->count++];
+    memset(job, 0, sizeof(*job));
+    job->in_path = in_path;
+    job->out_path = out_path;
+    job->key_index = key_index;
+    return 0;
+}
+
+static void free_job_list(struct job_list *list) {
+    for (size_t i = 0; i < list->count; ++i) {
+        free((char *) list->jobs[i].in_path);
+        free((char *) list->jobs[i].out_path);
+    }
+    free(list->jobs);
+}
+
+/** Return a newly allocated `dir/name`, or NULL if out of memory.
+  */
+static char *join_path(const char *dir, const char *name) {
+    while (*name == '/') {
+        ++name;
+    }
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + strlen(name) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s%s%s", dir, dir_len > 0 && dir[dir_len - 1] == '/' ? "" : "/", name);
+    }
+    return path;
+}
+
+/** Create the missing parent directories of `path`.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int make_parents(const char *path) {
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    for (char *slash = strchr(copy + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(copy, 0777) != 0 && errno != EEXIST) {
+            free(copy);
+            return -1;
+        }
+        *slash = '/';
+    }
+    free(copy);
+    return 0;
+}
+
+/** Add every regular file under `dir` (relative path `rel`) whose name matches `pattern`,
+  * writing each to the same relative path under `out_dir`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int walk_dir(struct job_list *list, const char *dir, const char *rel,
+                    const char *pattern, const char *out_dir) {
+    char *path = *rel != '\0' ? join_path(dir, rel) : strdup(dir);
+    DIR *d = path != NULL ? opendir(path) : NULL;
+    if (d == NULL) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path != NULL ? path : dir, strerror(errno));
+        free(path);
+        return 1;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *child_rel = *rel != '\0' ? join_path(rel, entry->d_name) : strdup(entry->d_name);
+        char *child = child_rel != NULL ? join_path(dir, child_rel) : NULL;
+        struct stat st;
+        if (child == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            result = 1;
+        } else if (lstat(child, &st) != 0) {
+            fprintf(stderr, "Error: Cannot stat %s: %s\n", child, strerror(errno));
+            result = 1;
+        } else if (S_ISDIR(st.st_mode)) {
+            result = walk_dir(list, dir, child_rel, pattern, out_dir);
+        } else if (S_ISREG(st.st_mode) && fnmatch(pattern, entry->d_name, 0) == 0) {
+            if (add_job(list, child, join_path(out_dir, child_rel), 0) != 0) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                result = 1;
+            }
+            child = NULL;
+        }
+        free(child);
+        free(child_rel);
+    }
+    closedir(d);
+    free(path);
+    return result;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    return strcmp(((const struct cipher_job *) a)->in_path,
+                  ((const struct cipher_job *) b)->in_path);
+}
+
+/** Read a manifest with one file per line: `INPUT`, `INPUT<tab>OUTPUT` or
+  * `INPUT<tab>OUTPUT<tab>KEY_INDEX`. Blank lines and lines starting with `#` are skipped,
+  * and a missing output is `INPUT` under `out_dir`.
+  *
+  * \return 0 on success, 1 on failure (after printing an error)
+  */
+static int read_manifest(struct job_list *list, const char *path, const char *out_dir) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    int line_no = 0;
+    int result = 0;
+    while (result == 0 && (line_len = getline(&line, &line_cap, f)) >= 0) {
+        ++line_no;
+        if (line_len > 0 && line[line_len - 1] == '\n') {
+            line[--line_len] = '\0';
+        }
+        if (line_len == 0 || line[0] == '#') {
+            continue;
+        }
+        char *fields[3] = { line, NULL, NULL };
+        for (int i = 1; i < 3 && fields[i - 1] != NULL; ++i) {
+            fields[i] = strchr(fields[i - 1], '\t');
+            if (fields[i] != NULL) {
+                *fields[i]++ = '\0';
+            }
+        }
+        char *endptr = NULL;
+        size_t key_index = fields[2] != NULL ? strtoul(fields[2], &endptr, 10) : 0;
+        if ((fields[2] != NULL && (*fields[2] == '\0' || *endptr != '\0'))
+            || (fields[1] == NULL && out_dir == NULL)) {
+            fprintf(stderr, "Error: %s:%d: Invalid manifest line.\n", path, line_no);
+            result = 1;
+        } else if (add_job(list, strdup(fields[0]),
+                           fields[1] != NULL ? strdup(fields[1]) : join_path(out_dir, fields[0]),
+                           key_index) != 0) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            result = 1;
+        }
+    }
+    if (ferror(f)) {
+        fprintf(stderr, "Error: Cannot read %s: %s\n", path, strerror(errno));
+        result = 1;
+    }
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+    return result;
+}
+
+/** Options for `cli jobs`.
+  */
+struct jobs_options {
+    const char *operation;
+    const char *key;
+    const char *manifest;
+    const char *dir;
+    const char *pattern;
+    const char *out_dir;
+    size_t chunk_size;
+    int num_threads;
+    int chain_keys;
+};
+
+static void jobs_usage(void) {
+    fprintf(stderr,
+            "Usage: cli jobs [options] <operation> <key>\n"
+            "\n"
+            "Transform many files at once, splitting large files into chunks so that every\n"
+            "thread stays busy. Exactly one of --manifest and --dir is required.\n"
+            "\n"
+            "Options:\n"
+            "  --manifest PATH  read the files to process from PATH (- for stdin), one per\n"
+            "                   line as INPUT[<tab>OUTPUT[<tab>KEY_INDEX]]\n"
+            "  --dir DIR        process every file under DIR\n"
+            "  --glob PATTERN   with --dir, only process files whose names match PATTERN\n"
+            "  --out-dir DIR    write each output to the input's path under DIR\n"
+            "  --threads N      use N threads (default one per CPU)\n"
+            "  --chunk MIB      split files into chunks of MIB mebibytes (default 8)\n"
+            "  --chain-keys     continue the Vigenere key from one file into the next, in\n"
+            "                   manifest (or sorted path) order\n");
+}
+
+/** \return 0 on success, 1 on failure
+  */
+static int parse_jobs_options(int argc, char **argv, struct jobs_options *opts) {
+    const char *positional[2];
+    int num_positional = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->pattern = "*";
+    opts->chunk_size = (size_t) 8 << 20;
+    opts->num_threads = cpus < 1 ? 1 : cpus > CIPHER_MAX_THREADS ? CIPHER_MAX_THREADS : (int) cpus;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            if (num_positional == 2) {
+                fprintf(stderr, "Error: Invalid number of arguments.\n");
+                return 1;
+            }
+            positional[num_positional++] = arg;
+            continue;
+        }
+        if (strcmp(arg, "--chain-keys") == 0) {
+            opts->chain_keys = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (strcmp(arg, "--manifest") == 0) {
+            opts->manifest = value;
+        } else if (strcmp(arg, "--dir") == 0) {
+            opts->dir = value;
+        } else if (strcmp(arg, "--glob") == 0) {
+            opts->pattern = value;
+        } else if (strcmp(arg, "--out-dir") == 0) {
+            opts->out_dir = value;
+        } else if (strcmp(arg, "--threads") == 0) {
+            long n;
+            if (parse_long_option(arg, value, 1, CIPHER_MAX_THREADS, &n) != 0) {
+                return 1;
+            }
+            opts->num_threads = (int) n;
+        } else if (strcmp(arg, "--chunk") == 0) {
+            long mib;
+            if (parse_long_option(arg, value, 1, 1024, &mib) != 0) {
+                return 1;
+            }
+            opts->chunk_size = (size_t) mib << 20;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s.\n", arg);
+            return 1;
+        }
+    }
+    if (num_positional != 2) {
+        fprintf(stderr, "Error: Invalid number of arguments.\n");
+        return 1;
+    }
+    opts->operation = positional[0];
+    opts->key = positional[1];
+    if ((opts->manifest == NULL) == (opts->dir == NULL)) {
+        fprintf(stderr, "Error: Exactly one of --manifest and --dir is required.\n");
+        return 1;
+    }
+    if (opts->dir != NULL && opts->out_dir == NULL) {
+        fprintf(stderr, "Error: --dir requires --out-dir.\n");
+        return 1;
+    }
+    return 0;
+}
+
+int cli_jobs(int argc, char **argv) {
+    struct jobs_options opts;
+    struct job_list list = { 0 };
+    struct cipher_ctx ctx;
+    enum cipher_op op;
+    int shift = 0;
+
+    if (parse_jobs_options(argc, argv, &opts) != 0) {
+        jobs_usage();
+        return 1;
+    }
+    if (cipher_op_from_name(opts.operation, &op) != 0) {
+        fprintf(stderr, "Error: Invalid operation. Must be one of: caesar-encrypt, caesar-decrypt, vigenere-encrypt, vigenere-decrypt.\n");
+        return 1;
+    }
+    if (op == CAESAR_ENCRYPT || op == CAESAR_DECRYPT) {
+        char *endptr;
+        shift = strtol(opts.key, &endptr, 10);
+        if (*endptr != '\0') {
+            fprintf(stderr, "Error: Invalid key for Caesar cipher. Must be an integer.\n");
+            return 1;
+        }
+    }
+
+    int result = opts.manifest != NULL ? read_manifest(&list, opts.manifest, opts.out_dir)
+                                       : walk_dir(&list, opts.dir, "", opts.pattern, opts.out_dir);
+    if (result == 0 && opts.dir != NULL) {
+        qsort(list.jobs, list.count, sizeof(*list.jobs), compare_jobs);
+    }
+    for (size_t i = 0; i < list.count && result == 0; ++i) {
+        if (make_parents(list.jobs[i].out_path) != 0) {
+            fprintf(stderr, "Error: Cannot create the directory for %s: %s\n",
+                    list.jobs[i].out_path, strerror(errno));
+            result = 1;
+        }
+    }
+    if (result != 0) {
+        free_job_list(&list);
+        return 1;
+    }
+    if (cipher_ctx_init(&ctx, op, 'A', 'Z', shift, (const uint8_t *) opts.key,
+                        strlen(opts.key)) != 0) {
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        free_job_list(&list);
+        return 1;
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (cipher_run_jobs(&ctx, list.jobs, list.count, opts.chain_keys, opts.chunk_size,
+                        opts.num_threads) != 0 && errno == ENOMEM) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        result = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t bytes = 0;
+    size_t failures = 0;
+    for (size_t i = 0; i < list.count; ++i) {
+        if (list.jobs[i].error != 0) {
+            fprintf(stderr, "Error: %s: %s\n", list.jobs[i].in_path,
+                    strerror(list.jobs[i].error));
+            failures++;
+            result = 1;
+        } else {
+            bytes += list.jobs[i].size;
+        }
+    }
+    double seconds = (double) (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu files (%zu failed), %llu bytes in %.3f s, %.1f MB/s on %d threads\n",
+           list.count, failures, (unsigned long long) bytes, seconds,
+           seconds > 0 ? bytes / seconds / 1e6 : 0.0, opts.num_threads);
+
+    cipher_ctx_free(&ctx);
+    free_job_list(&list);
+    return result;
+}
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Input is transformed this many bytes at a time, so that the key shifts read for a
+  * piece are still in cache when they are applied.
+  */
+#define KEYSTREAM_PIECE ((size_t) 64 * 1024)
+
+/** A regular key file is mapped this many bytes at a time, which bounds the address space
+  * and memory used however long the key is. Must be a multiple of the page size.
+  */
+#define KEYSTREAM_WINDOW ((size_t) 64 << 20)
+
+/** Shift the in-range bytes of `in` by the queued shifts, the n-th in-range byte by
+  * `shifts[n]`. The bulk of the input goes through `vigenere_simd`, given a period too
+  * long to ever wrap, so a key that never repeats runs through the same kernels as one
+  * that does. `shifts` must hold one entry per in-range byte, plus
+  * `VIGENERE_SIMD_OVERREAD` more that may be read but are not used.
+  *
+  * \return The number of shifts used
+  */
+static size_t apply_shifts(uint8_t low, int range_size, const uint8_t *shifts,
+                           const uint8_t *in, size_t len, uint8_t *out) {
+    size_t k = 0;
+    size_t i = vigenere_simd(low, range_size, shifts, SIZE_MAX, &k, in, len, out);
+
+    for (; i < len; ++i) {
+        uint8_t c = in[i];
+        int t = (uint8_t) (c - low);
+        int in_range = t < range_size;
+        int r = t + shifts[k];
+        r -= r >= range_size ? range_size : 0;
+        out[i] = in_range ? (uint8_t) (low + r) : c;
+        k += in_range;
+    }
+    return k;
+}
+
+/** Set up the parts common to both kinds of key stream, with room for `capacity` shifts.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int keystream_init(struct keystream *ks, enum keystream_kind kind, enum cipher_op op,
+                          char range_low, char range_high, size_t capacity) {
+    memset(ks, 0, sizeof(*ks));
+    ks->key_fd = -1;
+    ks->kind = kind;
+    ks->op = op;
+    ks->low = (uint8_t) range_low;
+    ks->high = (uint8_t) range_high;
+    if ((op != VIGENERE_ENCRYPT && op != VIGENERE_DECRYPT) || ks->high <= ks->low) {
+        errno = EINVAL;
+        return -1;
+    }
+    ks->range_size = ks->high - ks->low + 1;
+    for (int c = 0; c < 256; ++c) {
+        int t = (c - ks->low) % ks->range_size;
+        ks->shift_of[c] = (int16_t) (t < 0 ? t + ks->range_size : t);
+    }
+    ks->capacity = capacity;
+    ks->shifts = malloc(capacity + VIGENERE_SIMD_OVERREAD);
+    return ks->shifts == NULL ? -1 : 0;
+}
+
+int keystream_init_running(struct keystream *ks, enum cipher_op op, char range_low,
+                           char range_high, int key_fd, int filter_key) {
+    if (keystream_init(ks, KEYSTREAM_RUNNING, op, range_low, range_high,
+                       2 * KEYSTREAM_PIECE) != 0) {
+        keystream_free(ks);
+        return -1;
+    }
+    for (int c = 0; c < 256; ++c) {
+        int shift = ks->shift_of[c];
+        if (op == VIGENERE_DECRYPT) {
+            shift = shift == 0 ? 0 : ks->range_size - shift;
+        }
+        ks->shift_of[c] = (int16_t) (filter_key && (c < ks->low || c > ks->high) ? -1 : shift);
+    }
+
+    /* A regular file is read through windows of a mapping from its current position; any
+     * other source, such as a pipe, with read. */
+    struct stat st;
+    ks->key_fd = key_fd;
+    off_t position = lseek(key_fd, 0, SEEK_CUR);
+    if (position >= 0 && fstat(key_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        ks->key_mapped = 1;
+        ks->key_size = st.st_size;
+        ks->window_offset = position - position % page_size;
+        ks->window_pos = (size_t) (position - ks->window_offset);
+        return 0;
+    }
+    ks->read_buf = malloc(KEYSTREAM_PIECE);
+    if (ks->read_buf == NULL) {
+        keystream_free(ks);
+        return -1;
+    }
+    return 0;
+}
+
+int keystream_init_autokey(struct keystream *ks, enum cipher_op op, char range_low,
+                           char range_high, const uint8_t *primer, size_t primer_len) {
+    if (keystream_init(ks, KEYSTREAM_AUTOKEY, op, range_low, range_high,
+                       primer_len + KEYSTREAM_PIECE) != 0 || primer_len == 0) {
+        keystream_free(ks);
+        errno = primer_len == 0 ? EINVAL : errno;
+        return -1;
+    }
+    for (size_t i = 0; i < primer_len; ++i) {
+        ks->shifts[i] = (uint8_t) ks->shift_of[primer[i]];
+    }
+    ks->tail = primer_len;
+    return 0;
+}
+
+void keystream_free(struct keystream *ks) {
+    if (ks->window != NULL) {
+        munmap(ks->window, ks->window_len);
+    }
+    free(ks->shifts);
+    free(ks->read_buf);
+    ks->window = NULL;
+    ks->shifts = NULL;
+    ks->read_buf = NULL;
+}
+
+/** Convert key bytes to shifts, dropping the bytes that the key filter skips.
+  *
+  * \return The number of shifts written
+  */
+static size_t convert_key(const struct keystream *ks, uint8_t *buf, const uint8_t *raw,
+                          size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        int16_t shift = ks->shift_of[raw[i]];
+        buf[n] = (uint8_t) shift;
+        n += shift >= 0;
+    }
+    return n;
+}
+
+/** Read up to `max` more key bytes, converting them to shifts at `buf`. Fewer shifts
+  * than bytes are added when the key filter skips some of them.
+  *
+  * \return The number of key bytes read, 0 at the end of the key, or -1 on failure (with
+  *     `errno` set)
+  */
+static ssize_t read_key(struct keystream *ks, uint8_t *buf, size_t max, size_t *added) {
+    if (!ks->key_mapped) {
+        /* Read into a separate buffer: converting in place makes every store land just
+         * ahead of the next load, which runs several times slower. */
+        ssize_t n;
+        max = max < KEYSTREAM_PIECE ? max : KEYSTREAM_PIECE;
+        do {
+            n = read(ks->key_fd, ks->read_buf, max);
+        } while (n < 0 && errno == EINTR);
+        *added = n > 0 ? convert_key(ks, buf, ks->read_buf, (size_t) n) : 0;
+        return n;
+    }
+
+    if (ks->window != NULL && ks->window_pos == ks->window_len) {
+        munmap(ks->window, ks->window_len);
+        ks->window = NULL;
+        ks->window_offset += ks->window_len;
+        ks->window_pos = 0;
+    }
+    if (ks->window == NULL) {
+        if (ks->window_offset + ks->window_pos >= ks->key_size) {
+            return 0;
+        }
+        uint64_t left = ks->key_size - ks->window_offset;
+        ks->window_len = left < KEYSTREAM_WINDOW ? (size_t) left : KEYSTREAM_WINDOW;
+        void *addr = mmap(NULL, ks->window_len, PROT_READ, MAP_PRIVATE, ks->key_fd,
+                          ks->window_offset);
+        if (addr == MAP_FAILED) {
+            return -1;
+        }
+        madvise(addr, ks->window_len, MADV_SEQUENTIAL);
+        ks->window = addr;
+    }
+    size_t n = ks->window_len - ks->window_pos;
+    n = n < max ? n : max;
+    *added = convert_key(ks, buf, ks->window + ks->window_pos, n);
+    ks->window_pos += n;
+    return (ssize_t) n;
+}
+
+/** Move the queued shifts to the front of the buffer.
+  */
+static void compact_shifts(struct keystream *ks) {
+    memmove(ks->shifts, ks->shifts + ks->head, ks->tail - ks->head);
+    ks->tail -= ks->head;
+    ks->head = 0;
+}
+
+/** Queue key shifts until at least `need` are waiting.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set to `ENODATA` if the key ran
+  *     out first)
+  */
+static int fill_running_key(struct keystream *ks, size_t need) {
+    if (ks->tail - ks->head >= need) {
+        return 0;
+    }
+    compact_shifts(ks);
+    while (ks->tail < need) {
+        size_t added;
+        ssize_t n = read_key(ks, ks->shifts + ks->tail, ks->capacity - ks->tail, &added);
+        if (n <= 0) {
+            errno = n < 0 ? errno : ENODATA;
+            return -1;
+        }
+        ks->tail += added;
+    }
+    return 0;
+}
+
+/** Decrypt with an autokey, whose key is the primer followed by the plaintext being
+  * recovered. The queued shifts form a ring of the last `tail` plaintext characters, as
+  * offsets from `low`, which are subtracted.
+  */
+static void autokey_decrypt(struct keystream *ks, const uint8_t *in, size_t len,
+                            uint8_t *out) {
+    uint8_t *ring = ks->shifts;
+    size_t ring_len = ks->tail;
+    size_t pos = ks->head;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = in[i];
+        int t = (uint8_t) (c - ks->low);
+        if (t >= ks->range_size) {
+            out[i] = c;
+            continue;
+        }
+        int r = t - ring[pos];
+        r += r < 0 ? ks->range_size : 0;
+        out[i] = (uint8_t) (ks->low + r);
+        ring[pos] = (uint8_t) r;
+        pos = pos + 1 == ring_len ? 0 : pos + 1;
+    }
+    ks->head = pos;
+}
+
+/** Transform one piece of at most `KEYSTREAM_PIECE` bytes.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int update_piece(struct keystream *ks, const uint8_t *in, size_t len, uint8_t *out) {
+    if (ks->kind == KEYSTREAM_AUTOKEY && ks->op == VIGENERE_DECRYPT) {
+        autokey_decrypt(ks, in, len, out);
+        return 0;
+    }
+
+    if (ks->kind == KEYSTREAM_AUTOKEY) {
+        /* The plaintext joins the end of the key before it is encrypted, which keeps the
+         * queue exactly as long as the primer. */
+        if (ks->capacity - ks->tail < len) {
+            compact_shifts(ks);
+        }
+        ks->tail += compact_in_range((char) ks->low, (char) ks->high, in, len,
+                                     ks->shifts + ks->tail);
+    } else if (fill_running_key(ks, count_in_range((char) ks->low, (char) ks->high, in,
+                                                   len)) != 0) {
+        return -1;
+    }
+
+    ks->head += apply_shifts(ks->low, ks->range_size, ks->shifts + ks->head, in, len, out);
+    return 0;
+}
+
+int keystream_update(struct keystream *ks, const uint8_t *in, size_t len, uint8_t *out) {
+    uint64_t start = metrics_enabled() ? metrics_clock() : 0;
+
+    for (size_t done = 0; done < len;) {
+        size_t n = len - done < KEYSTREAM_PIECE ? len - done : KEYSTREAM_PIECE;
+        if (update_piece(ks, in + done, n, out + done) != 0) {
+            return -1;
+        }
+        done += n;
+    }
+    if (start != 0) {
+        uint64_t elapsed = metrics_clock() - start;
+        metrics_record(ks->op, len, count_in_range((char) ks->low, (char) ks->high, out, len),
+                       elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Each power of two of latency is split into this many buckets (as a power of two), so
+  * the bounds of a bucket are within 12.5% of any value in it.
+  */
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+
+/** Buckets needed to cover every 64-bit latency in nanoseconds.
+  */
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+#define METRICS_NUM_OPS (VIGENERE_DECRYPT + 1)
+
+/** Counters for one operation.
+  */
+struct op_metrics {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t in_range;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+};
+
+/** The counters written by one thread.
+  *
+  * Shards are never freed: when a thread exits its shard is marked unused and taken over,
+  * counts and all, by the next thread that records anything, so the totals stay correct
+  * and the number of shards is bounded by the most threads ever recording at once.
+  */
+struct metrics_shard {
+    struct metrics_shard *next;
+    int in_use;
+    struct op_metrics ops[METRICS_NUM_OPS];
+};
+
+static int enabled;
+static struct metrics_shard *shards;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread struct metrics_shard *local_shard;
+
+static void release_shard(void *shard) {
+    __atomic_store_n(&((struct metrics_shard *) shard)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_shard_key(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+/** Return the calling thread's shard, claiming an unused one or adding a new one to the
+  * list on the thread's first call.
+  *
+  * \return The shard, or NULL if memory has run out
+  */
+static struct metrics_shard *acquire_shard(void) {
+    if (local_shard != NULL) {
+        return local_shard;
+    }
+    pthread_once(&shard_key_once, create_shard_key);
+
+    struct metrics_shard *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+    for (; shard != NULL; shard = shard->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&shard->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (shard == NULL) {
+        shard = calloc(1, sizeof(*shard));
+        if (shard == NULL) {
+            return NULL;
+        }
+        shard->in_use = 1;
+        shard->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&shards, &shard->next, shard, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+    return shard;
+}
+
+/** Add `n` to a counter of the calling thread's shard.
+  *
+  * Only the owning thread writes a shard, so no read-modify-write is needed; the atomic
+  * accesses only stop a concurrent dump from seeing a torn value.
+  */
+static void bump(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < METRICS_SUB_COUNT) {
+        return (int) ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - METRICS_SUB_BITS;
+    return (shift + 1) * METRICS_SUB_COUNT + (int) (ns >> shift) - METRICS_SUB_COUNT;
+}
+
+/** Return the largest latency that falls in bucket `b`.
+  */
+static uint64_t bucket_high(int b) {
+    if (b + 1 >= METRICS_BUCKETS) {
+        return UINT64_MAX;
+    }
+    b += 1;
+    if (b < METRICS_SUB_COUNT) {
+        return (uint64_t) b - 1;
+    }
+    int shift = b / METRICS_SUB_COUNT - 1;
+    return ((uint64_t) (b % METRICS_SUB_COUNT + METRICS_SUB_COUNT) << shift) - 1;
+}
+
+void metrics_enable(int on) {
+    __atomic_store_n(&enabled, on != 0, __ATOMIC_RELAXED);
+}
+
+int metrics_enabled(void) {
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+void metrics_record(enum cipher_op op, size_t bytes, size_t in_range, uint64_t elapsed_ns) {
+    struct metrics_shard *shard = acquire_shard();
+    if (shard == NULL) {
+        return;
+    }
+    struct op_metrics *m = &shard->ops[op];
+    bump(&m->calls, 1);
+    bump(&m->bytes, bytes);
+    bump(&m->in_range, in_range);
+    bump(&m->total_ns, elapsed_ns);
+    bump(&m->buckets[bucket_of(elapsed_ns)], 1);
+    if (elapsed_ns > __atomic_load_n(&m->max_ns, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&m->max_ns, elapsed_ns, __ATOMIC_RELAXED);
+    }
+}
+
+/** Sum the counters of every shard into `totals`.
+  */
+static void merge_shards(struct op_metrics totals[METRICS_NUM_OPS]) {
+    memset(totals, 0, sizeof(struct op_metrics) * METRICS_NUM_OPS);
+    struct metrics_shard *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+    for (; shard != NULL; shard = shard->next) {
+        for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+            const struct op_metrics *m = &shard->ops[op];
+            struct op_metrics *t = &totals[op];
+            t->calls += __atomic_load_n(&m->calls, __ATOMIC_RELAXED);
+            t->bytes += __atomic_load_n(&m->bytes, __ATOMIC_RELAXED);
+            t->in_range += __atomic_load_n(&m->in_range, __ATOMIC_RELAXED);
+            t->total_ns += __atomic_load_n(&m->total_ns, __ATOMIC_RELAXED);
+            uint64_t max_ns = __atomic_load_n(&m->max_ns, __ATOMIC_RELAXED);
+            t->max_ns = max_ns > t->max_ns ? max_ns : t->max_ns;
+            for (int b = 0; b < METRICS_BUCKETS; ++b) {
+                t->buckets[b] += __atomic_load_n(&m->buckets[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+/** Return the latency at quantile `q` of the merged histogram `m`, reported as the top of
+  * its bucket (but no more than the largest latency seen).
+  */
+static uint64_t quantile(const struct op_metrics *m, uint64_t count, double q) {
+    uint64_t rank = (uint64_t) (q * count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    uint64_t seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; ++b) {
+        seen += m->buckets[b];
+        if (seen >= rank) {
+            uint64_t high = bucket_high(b);
+            return high < m->max_ns ? high : m->max_ns;
+        }
+    }
+    return m->max_ns;
+}
+
+static uint64_t histogram_count(const struct op_metrics *m) {
+    uint64_t count = 0;
+    for (int b = 0; b < METRICS_BUCKETS; ++b) {
+        count += m->buckets[b];
+    }
+    return count;
+}
+
+static void write_prometheus(FILE *out, const struct op_metrics totals[METRICS_NUM_OPS]) {
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t field;
+    } counters[] = {
+        { "cipher_calls_total", "Calls to each cipher operation.",
+          offsetof(struct op_metrics, calls) },
+        { "cipher_bytes_total", "Bytes transformed by each cipher operation.",
+          offsetof(struct op_metrics, bytes) },
+        { "cipher_in_range_bytes_total", "Transformed bytes that fell within the range.",
+          offsetof(struct op_metrics, in_range) },
+    };
+
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); ++c) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", counters[c].name, counters[c].help,
+                counters[c].name);
+        for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+            uint64_t value = *(const uint64_t *) ((const char *) &totals[op] + counters[c].field);
+            fprintf(out, "%s{op=\"%s\"} %llu\n", counters[c].name,
+                    cipher_op_name((enum cipher_op) op), (unsigned long long) value);
+        }
+    }
+
+    /* Only the buckets that have been used are listed, which Prometheus allows. */
+    fprintf(out, "# HELP cipher_call_duration_seconds Latency of each cipher call.\n"
+                 "# TYPE cipher_call_duration_seconds histogram\n");
+    for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+        const struct op_metrics *m = &totals[op];
+        const char *name = cipher_op_name((enum cipher_op) op);
+        uint64_t cumulative = 0;
+        for (int b = 0; b + 1 < METRICS_BUCKETS; ++b) {
+            if (m->buckets[b] != 0) {
+                cumulative += m->buckets[b];
+                fprintf(out, "cipher_call_duration_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n",
+                        name, bucket_high(b) / 1e9, (unsigned long long) cumulative);
+            }
+        }
+        fprintf(out, "cipher_call_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n"
+                     "cipher_call_duration_seconds_sum{op=\"%s\"} %.9g\n"
+                     "cipher_call_duration_seconds_count{op=\"%s\"} %llu\n",
+                name, (unsigned long long) histogram_count(m), name, m->total_ns / 1e9, name,
+                (unsigned long long) histogram_count(m));
+    }
+}
+
+static void write_json(FILE *out, const struct op_metrics totals[METRICS_NUM_OPS]) {
+    fprintf(out, "{\"operations\": {");
+    for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+        const struct op_metrics *m = &totals[op];
+        uint64_t count = histogram_count(m);
+        double seconds = m->total_ns / 1e9;
+        fprintf(out,
+                "%s\n  \"%s\": {\"calls\": %llu, \"bytes\": %llu, \"in_range_bytes\": %llu, "
+                "\"in_range_ratio\": %.6f, \"busy_seconds\": %.9f, \"throughput_mb_s\": %.3f, "
+                "\"latency_ns\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+                "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+                op == 0 ? "" : ",", cipher_op_name((enum cipher_op) op),
+                (unsigned long long) m->calls, (unsigned long long) m->bytes,
+                (unsigned long long) m->in_range,
+                m->bytes > 0 ? (double) m->in_range / m->bytes : 0.0, seconds,
+                seconds > 0 ? m->bytes / seconds / 1e6 : 0.0,
+                count > 0 ? (double) m->total_ns / count : 0.0,
+                (unsigned long long) (count > 0 ? quantile(m, count, 0.5) : 0),
+                (unsigned long long) (count > 0 ? quantile(m, count, 0.9) : 0),
+                (unsigned long long) (count > 0 ? quantile(m, count, 0.99) : 0),
+                (unsigned long long) (count > 0 ? quantile(m, count, 0.999) : 0),
+                (unsigned long long) m->max_ns);
+    }
+    fprintf(out, "\n}}\n");
+}
+
+int metrics_dump(int fd, enum metrics_format format) {
+    struct op_metrics *totals = malloc(sizeof(*totals) * METRICS_NUM_OPS);
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = totals != NULL ? open_memstream(&text, &len) : NULL;
+    if (out == NULL) {
+        free(totals);
+        return -1;
+    }
+
+    /* The text is built in memory and written at once, so that a dump does not interleave
+     * with other output to the same descriptor. */
+    merge_shards(totals);
+    if (format == METRICS_JSON) {
+        write_json(out, totals);
+    } else {
+        write_prometheus(out, totals);
+    }
+    free(totals);
+    if (fclose(out) != 0) {
+        free(text);
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, text + done, len - done);
+        if (n < 0 && errno != EINTR) {
+            result = -1;
+            break;
+        }
+        done += n > 0 ? (size_t) n : 0;
+    }
+    int saved_errno = errno;
+    free(text);
+    errno = saved_errno;
+    return result;
+}
+
+int metrics_format_from_name(const char *name, enum metrics_format *format) {
+    if (strcmp(name, "prometheus") == 0) {
+        *format = METRICS_PROMETHEUS;
+    } else if (strcmp(name, "json") == 0) {
+        *format = METRICS_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/** What a `metrics_watch_signal` thread waits for and where it writes.
+  */
+struct signal_watch {
+    sigset_t signals;
+    int fd;
+    enum metrics_format format;
+};
+
+static void *watch_signal(void *arg) {
+    struct signal_watch *watch = arg;
+    for (;;) {
+        int signo;
+        if (sigwait(&watch->signals, &signo) == 0) {
+            metrics_dump(watch->fd, watch->format);
+        }
+    }
+    return NULL;
+}
+
+int metrics_watch_signal(int signo, int fd, enum metrics_format format) {
+    struct signal_watch *watch = malloc(sizeof(*watch));
+    if (watch == NULL) {
+        return -1;
+    }
+    sigemptyset(&watch->signals);
+    sigaddset(&watch->signals, signo);
+    watch->fd = fd;
+    watch->format = format;
+
+    pthread_t thread;
+    int error = pthread_sigmask(SIG_BLOCK, &watch->signals, NULL);
+    if (error == 0) {
+        error = pthread_create(&thread, NULL, watch_signal, watch);
+    }
+    if (error != 0) {
+        free(watch);
+        errno = error;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Files are mapped this many bytes at a time, which bounds the address space used
+  * however large the file is. Must be a multiple of the page size.
+  */
+#define MMAP_WINDOW ((size_t) 256 << 20)
+
+/** Map `len` bytes of `fd` at `offset`, hinting that they will be read sequentially.
+  *
+  * \return The mapping, or `MAP_FAILED` (with `errno` set)
+  */
+static void *map_window(int fd, int prot, off_t offset, size_t len) {
+    void *addr = mmap(NULL, len, prot, MAP_SHARED, fd, offset);
+    if (addr != MAP_FAILED) {
+        madvise(addr, len, MADV_SEQUENTIAL);
+    }
+    return addr;
+}
+
+/** Apply `ctx` to the first `size` bytes of `in_fd`, writing to the same offsets in
+  * `out_fd`, or in place if `out_fd` is -1.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int transform_mapped(const struct cipher_ctx *ctx, int in_fd, int out_fd,
+                            off_t size, int num_threads) {
+    size_t key_index = 0;
+
+    for (off_t offset = 0; offset < size; offset += (off_t) MMAP_WINDOW) {
+        size_t len = size - offset < (off_t) MMAP_WINDOW ? (size_t) (size - offset) : MMAP_WINDOW;
+        int in_prot = out_fd < 0 ? PROT_READ | PROT_WRITE : PROT_READ;
+        uint8_t *in = map_window(in_fd, in_prot, offset, len);
+        if (in == MAP_FAILED) {
+            return -1;
+        }
+        uint8_t *out = in;
+        if (out_fd >= 0) {
+            out = map_window(out_fd, PROT_READ | PROT_WRITE, offset, len);
+            if (out == MAP_FAILED) {
+                int saved_errno = errno;
+                munmap(in, len);
+                errno = saved_errno;
+                return -1;
+            }
+        }
+
+        key_index = cipher_ctx_apply_parallel(ctx, key_index, in, len, out, num_threads);
+
+        if (out != in) {
+            munmap(out, len);
+        }
+        munmap(in, len);
+    }
+    return 0;
+}
+
+/** Close `fd` without disturbing `errno`, for use on error paths.
+  */
+static void close_keep_errno(int fd) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+}
+
+int cipher_mmap_file(const struct cipher_ctx *ctx, const char *in_path,
+                     const char *out_path, int num_threads) {
+    struct stat in_stat;
+    struct stat out_stat;
+    int in_place = out_path == NULL;
+    int out_fd = -1;
+
+    if (!in_place && stat(out_path, &out_stat) == 0 && stat(in_path, &in_stat) == 0) {
+        in_place = in_stat.st_dev == out_stat.st_dev && in_stat.st_ino == out_stat.st_ino;
+    }
+
+    int in_fd = open(in_path, in_place ? O_RDWR : O_RDONLY);
+    if (in_fd < 0) {
+        return -1;
+    }
+    if (fstat(in_fd, &in_stat) != 0) {
+        goto fail_in;
+    }
+    if (!S_ISREG(in_stat.st_mode)) {
+        errno = EINVAL;
+        goto fail_in;
+    }
+
+    if (!in_place) {
+        out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (out_fd < 0) {
+            goto fail_in;
+        }
+        if (ftruncate(out_fd, in_stat.st_size) != 0) {
+            goto fail_out;
+        }
+        /* Reserve the blocks now, so that running out of space is reported here rather
+         * than as a SIGBUS when a page of the mapping is first written. */
+        int err = posix_fallocate(out_fd, 0, in_stat.st_size);
+        if (err != 0 && err != EINVAL && err != EOPNOTSUPP) {
+            errno = err;
+            goto fail_out;
+        }
+    }
+
+    if (transform_mapped(ctx, in_fd, out_fd, in_stat.st_size, num_threads) != 0) {
+        goto fail_out;
+    }
+    if (out_fd >= 0 && close(out_fd) != 0) {
+        out_fd = -1;
+        goto fail_out;
+    }
+    close(in_fd);
+    return 0;
+
+fail_out:
+    if (out_fd >= 0) {
+        close_keep_errno(out_fd);
+    }
+fail_in:
+    close_keep_errno(in_fd);
+    return -1;
+}
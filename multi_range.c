@@ -0,0 +1,198 @@
+#include "crypto.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+int multi_ctx_init(struct multi_ctx *ctx, enum cipher_op op, const struct cipher_range *ranges,
+                   int num_ranges, int shift, const uint8_t *key, size_t key_len,
+                   enum key_policy policy) {
+    memset(ctx, 0, sizeof(*ctx));
+    if (num_ranges < 1 || num_ranges > CIPHER_MAX_RANGES) {
+        errno = EINVAL;
+        return -1;
+    }
+    ctx->op = op;
+    ctx->policy = policy;
+    ctx->num_ranges = num_ranges;
+
+    for (int r = 0; r < num_ranges; ++r) {
+        uint8_t low = (uint8_t) ranges[r].low;
+        uint8_t high = (uint8_t) ranges[r].high;
+        if (high <= low) {
+            errno = EINVAL;
+            return -1;
+        }
+        for (int c = low; c <= high; ++c) {
+            if (ctx->range_of[c] != 0) {
+                errno = EINVAL;
+                return -1;
+            }
+            ctx->range_of[c] = (uint8_t) (r + 1);
+        }
+        ctx->low[r] = low;
+        ctx->range_size[r] = high - low + 1;
+    }
+
+    if (op == CAESAR_ENCRYPT || op == CAESAR_DECRYPT) {
+        for (int c = 0; c < 256; ++c) {
+            int r = ctx->range_of[c] - 1;
+            if (r < 0) {
+                ctx->table[c] = (uint8_t) c;
+                continue;
+            }
+            int size = ctx->range_size[r];
+            int s = shift % size;
+            s += s < 0 ? size : 0;
+            s = op == CAESAR_DECRYPT && s != 0 ? size - s : s;
+            ctx->table[c] = (uint8_t) (ctx->low[r] + (c - ctx->low[r] + s) % size);
+        }
+        return 0;
+    }
+
+    if (key_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ctx->key_len = key_len;
+    ctx->key_tables = malloc(key_len * 256);
+    if (ctx->key_tables == NULL) {
+        return -1;
+    }
+
+    /* A key character's offset is read in the range it is applied in, so that each range
+     * is transformed as a single-range cipher over it alone would transform it, whatever
+     * the order of the ranges. */
+    for (size_t k = 0; k < key_len; ++k) {
+        uint8_t *row = ctx->key_tables + k * 256;
+        for (int c = 0; c < 256; ++c) {
+            int r = ctx->range_of[c] - 1;
+            if (r < 0) {
+                row[c] = (uint8_t) c;
+                continue;
+            }
+            int size = ctx->range_size[r];
+            int s = (key[k] - ctx->low[r]) % size;
+            s += s < 0 ? size : 0;
+            s = op == VIGENERE_DECRYPT && s != 0 ? size - s : s;
+            row[c] = (uint8_t) (ctx->low[r] + (c - ctx->low[r] + s) % size);
+        }
+    }
+    return 0;
+}
+
+void multi_ctx_free(struct multi_ctx *ctx) {
+    free(ctx->key_tables);
+    ctx->key_tables = NULL;
+}
+
+/** Transform every byte of `in` with the tables.
+  */
+static void transform(const struct multi_ctx *ctx, size_t *key_index, const uint8_t *in,
+                      size_t len, uint8_t *out) {
+    if (ctx->op == CAESAR_ENCRYPT || ctx->op == CAESAR_DECRYPT) {
+        for (size_t i = 0; i < len; ++i) {
+            out[i] = ctx->table[in[i]];
+        }
+        return;
+    }
+
+    size_t key_len = ctx->key_len;
+    if (ctx->policy == KEY_SHARED) {
+        size_t k = *key_index % key_len;
+        for (size_t i = 0; i < len; ++i) {
+            uint8_t c = in[i];
+            out[i] = ctx->key_tables[k * 256 + c];
+            k += ctx->range_of[c] != 0;
+            k = k == key_len ? 0 : k;
+        }
+        *key_index = k;
+        return;
+    }
+
+    /* Slot 0 belongs to bytes in no range: their row entry is the identity whatever the
+     * key position, and the slot never advances, so no branch is needed to skip them. */
+    size_t k[CIPHER_MAX_RANGES + 1] = { 0 };
+    for (int r = 0; r < ctx->num_ranges; ++r) {
+        k[r + 1] = key_index[r] % key_len;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = in[i];
+        uint8_t r = ctx->range_of[c];
+        out[i] = ctx->key_tables[k[r] * 256 + c];
+        k[r] += r != 0;
+        k[r] = k[r] == key_len ? 0 : k[r];
+    }
+    for (int r = 0; r < ctx->num_ranges; ++r) {
+        key_index[r] = k[r + 1];
+    }
+}
+
+/** Implementation of `multi_ctx_apply`, without the metrics. In sparse mode only the
+  * blocks with a byte somewhere between the lowest and highest ranges are transformed,
+  * as in `cipher_ctx_apply`.
+  */
+static void multi_apply(const struct multi_ctx *ctx, size_t *key_index, const uint8_t *in,
+                        size_t len, uint8_t *out) {
+    if (!ctx->sparse) {
+        transform(ctx, key_index, in, len, out);
+        return;
+    }
+
+    int low = 255;
+    int high = 0;
+    for (int r = 0; r < ctx->num_ranges; ++r) {
+        int top = ctx->low[r] + ctx->range_size[r] - 1;
+        low = ctx->low[r] < low ? ctx->low[r] : low;
+        high = top > high ? top : high;
+    }
+    int span = high - low + 1;
+    /* Reduce the key indexes as the plain path does, even if every block is skipped. */
+    transform(ctx, key_index, in, 0, out);
+    size_t i = 0;
+    while (i < len) {
+        size_t n = len - i < CIPHER_SCAN_SPAN ? len - i : CIPHER_SCAN_SPAN;
+        size_t idle = scan_blocks_simd((uint8_t) low, span, 0, in + i, n);
+        if (idle > 0 && in != out) {
+            memcpy(out + i, in + i, idle);
+        }
+        i += idle;
+        size_t busy = scan_blocks_simd((uint8_t) low, span, 1, in + i, n - idle);
+        busy = idle == 0 && busy == 0 ? n : busy;
+        transform(ctx, key_index, in + i, busy, out + i);
+        i += busy;
+    }
+}
+
+void multi_ctx_apply(const struct multi_ctx *ctx, size_t *key_index, const uint8_t *in,
+                     size_t len, uint8_t *out) {
+    if (!metrics_enabled()) {
+        multi_apply(ctx, key_index, in, len, out);
+        return;
+    }
+    uint64_t start = metrics_clock();
+    multi_apply(ctx, key_index, in, len, out);
+    uint64_t elapsed = metrics_clock() - start;
+    size_t in_range = 0;
+    for (size_t i = 0; i < len; ++i) {
+        in_range += ctx->range_of[out[i]] != 0;
+    }
+    metrics_record(ctx->op, len, in_range, elapsed);
+}
+
+int parse_ranges(const char *spec, struct cipher_range *ranges) {
+    int num_ranges = 0;
+
+    for (;;) {
+        if (num_ranges == CIPHER_MAX_RANGES || spec[0] == '\0' || spec[1] != '-'
+            || spec[2] == '\0' || (spec[3] != ',' && spec[3] != '\0')) {
+            return -1;
+        }
+        ranges[num_ranges].low = spec[0];
+        ranges[num_ranges].high = spec[2];
+        num_ranges++;
+        if (spec[3] == '\0') {
+            return num_ranges;
+        }
+        spec += 4;
+    }
+}
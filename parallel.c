@@ -0,0 +1,115 @@
+#include "crypto.h"
+#include <pthread.h>
+
+/** Chunk boundaries are rounded to a multiple of this many bytes, so that every chunk
+  * but the last is made of whole vectors.
+  */
+#define PARALLEL_ALIGN 64
+
+/** Inputs are not split into chunks smaller than this; below it, thread start-up costs
+  * more than it saves.
+  */
+#define PARALLEL_MIN_CHUNK (256 * 1024)
+
+/** A thread started by `run_parallel`.
+  */
+struct parallel_task {
+    void (*fn)(void *arg, int index);
+    void *arg;
+    int index;
+    pthread_t thread;
+    int started;
+};
+
+static void *run_task(void *arg) {
+    struct parallel_task *task = arg;
+    task->fn(task->arg, task->index);
+    return NULL;
+}
+
+void run_parallel(int num_tasks, void (*fn)(void *arg, int index), void *arg) {
+    struct parallel_task tasks[CIPHER_MAX_THREADS];
+
+    if (num_tasks > CIPHER_MAX_THREADS) {
+        num_tasks = CIPHER_MAX_THREADS;
+    }
+    for (int i = 1; i < num_tasks; ++i) {
+        tasks[i].fn = fn;
+        tasks[i].arg = arg;
+        tasks[i].index = i;
+        tasks[i].started = pthread_create(&tasks[i].thread, NULL, run_task, &tasks[i]) == 0;
+    }
+    if (num_tasks > 0) {
+        fn(arg, 0);
+    }
+    for (int i = 1; i < num_tasks; ++i) {
+        if (tasks[i].started) {
+            pthread_join(tasks[i].thread, NULL);
+        } else {
+            fn(arg, i);
+        }
+    }
+}
+
+/** One chunk of a `cipher_ctx_apply_parallel` call.
+  */
+struct parallel_chunk {
+    const struct cipher_ctx *ctx;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+    size_t count;
+    size_t key_index;
+};
+
+static void count_chunk(void *arg, int index) {
+    struct parallel_chunk *chunk = (struct parallel_chunk *) arg + index;
+    chunk->count = count_in_range((char) chunk->ctx->low, (char) chunk->ctx->high,
+                                  chunk->in, chunk->len);
+}
+
+static void apply_chunk(void *arg, int index) {
+    struct parallel_chunk *chunk = (struct parallel_chunk *) arg + index;
+    cipher_ctx_apply(chunk->ctx, chunk->key_index, chunk->in, chunk->len, chunk->out);
+}
+
+size_t cipher_ctx_apply_parallel(const struct cipher_ctx *ctx, size_t key_index,
+                                 const uint8_t *in, size_t len, uint8_t *out,
+                                 int num_threads) {
+    struct parallel_chunk chunks[CIPHER_MAX_THREADS];
+
+    if (num_threads > CIPHER_MAX_THREADS) {
+        num_threads = CIPHER_MAX_THREADS;
+    }
+    if ((size_t) num_threads > len / PARALLEL_MIN_CHUNK) {
+        num_threads = (int) (len / PARALLEL_MIN_CHUNK);
+    }
+    if (num_threads <= 1) {
+        return cipher_ctx_apply(ctx, key_index, in, len, out);
+    }
+
+    size_t chunk_len = (len / num_threads + PARALLEL_ALIGN - 1) & ~(size_t) (PARALLEL_ALIGN - 1);
+    int num_chunks = 0;
+    for (size_t start = 0; start < len; start += chunk_len) {
+        struct parallel_chunk *chunk = &chunks[num_chunks++];
+        chunk->ctx = ctx;
+        chunk->in = in + start;
+        chunk->out = out + start;
+        chunk->len = len - start < chunk_len ? len - start : chunk_len;
+        chunk->key_index = key_index;
+    }
+
+    int vigenere = ctx->op == VIGENERE_ENCRYPT || ctx->op == VIGENERE_DECRYPT;
+    if (vigenere) {
+        /* Each chunk starts where the key has got to after all the in-range bytes of the
+         * chunks before it. */
+        run_parallel(num_chunks, count_chunk, chunks);
+        key_index %= ctx->key_len;
+        for (int i = 0; i < num_chunks; ++i) {
+            chunks[i].key_index = key_index;
+            key_index = (key_index + chunks[i].count) % ctx->key_len;
+        }
+    }
+    run_parallel(num_chunks, apply_chunk, chunks);
+    return key_index;
+}
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Identifies a seek index file, and its format version.
+  */
+static const uint8_t seek_index_magic[4] = { 'C', 'S', 'X', 1 };
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) {
+        p[i] = (uint8_t) v;
+        v >>= 8;
+    }
+}
+
+/** Append a checkpoint holding the current count.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int append_checkpoint(struct seek_index *index) {
+    if (index->num_entries == index->capacity) {
+        size_t new_capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+        uint64_t *counts = realloc(index->counts, new_capacity * sizeof(*counts));
+        if (counts == NULL) {
+            return -1;
+        }
+        index->counts = counts;
+        index->capacity = new_capacity;
+    }
+    index->counts[index->num_entries++] = index->count;
+    return 0;
+}
+
+int seek_index_init(struct seek_index *index, char range_low, char range_high,
+                    uint64_t interval, size_t key_index) {
+    memset(index, 0, sizeof(*index));
+    if (interval == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    index->low = (uint8_t) range_low;
+    index->high = (uint8_t) range_high;
+    index->interval = interval;
+    index->count = key_index;
+    return append_checkpoint(index);
+}
+
+void seek_index_free(struct seek_index *index) {
+    free(index->counts);
+    index->counts = NULL;
+    index->num_entries = 0;
+    index->capacity = 0;
+}
+
+void seek_index_update(struct seek_index *index, const uint8_t *data, size_t len) {
+    while (len > 0 && index->error == 0) {
+        uint64_t room = index->interval - index->size % index->interval;
+        size_t n = len < room ? len : (size_t) room;
+        index->count += count_in_range((char) index->low, (char) index->high, data, n);
+        index->size += n;
+        data += n;
+        len -= n;
+        if (index->size % index->interval == 0 && append_checkpoint(index) != 0) {
+            index->error = errno;
+        }
+    }
+}
+
+int seek_index_save(const struct seek_index *index, const char *path) {
+    if (index->error != 0) {
+        errno = index->error;
+        return -1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    uint8_t header[SEEK_INDEX_HEADER] = { 0 };
+    memcpy(header, seek_index_magic, sizeof(seek_index_magic));
+    header[4] = index->low;
+    header[5] = index->high;
+    put_u64(header + 8, index->interval);
+    put_u64(header + 16, index->size);
+    put_u64(header + 24, index->num_entries);
+    int ok = fwrite(header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < index->num_entries; ++i) {
+        uint8_t entry[8];
+        put_u64(entry, index->counts[i]);
+        ok = fwrite(entry, sizeof(entry), 1, file) == 1;
+    }
+
+    int saved_errno = errno;
+    if (fclose(file) != 0 || !ok) {
+        errno = ok ? errno : saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+int seek_index_load(struct seek_index *index, const char *path) {
+    memset(index, 0, sizeof(*index));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* A short or inconsistent file is reported as EINVAL, like any other bad argument. */
+    int error = 0;
+    uint8_t header[SEEK_INDEX_HEADER];
+    if (fread(header, sizeof(header), 1, file) != 1
+        || memcmp(header, seek_index_magic, sizeof(seek_index_magic)) != 0) {
+        error = ferror(file) ? errno : EINVAL;
+    } else {
+        index->low = header[4];
+        index->high = header[5];
+        index->interval = get_u64(header + 8);
+        index->size = get_u64(header + 16);
+        uint64_t num_entries = get_u64(header + 24);
+        /* A checkpoint is written at the start and after every whole interval. */
+        if (index->interval == 0 || index->high <= index->low
+            || num_entries != index->size / index->interval + 1
+            || num_entries > SIZE_MAX / sizeof(*index->counts)) {
+            error = EINVAL;
+        } else if ((index->counts = malloc(num_entries * sizeof(*index->counts))) == NULL) {
+            error = errno;
+        } else {
+            index->capacity = (size_t) num_entries;
+        }
+    }
+    while (error == 0 && index->num_entries < index->capacity) {
+        uint8_t entry[8];
+        if (fread(entry, sizeof(entry), 1, file) != 1) {
+            error = ferror(file) ? errno : EINVAL;
+            break;
+        }
+        index->counts[index->num_entries++] = get_u64(entry);
+    }
+
+    fclose(file);
+    if (error != 0) {
+        seek_index_free(index);
+        errno = error;
+        return -1;
+    }
+    index->count = index->counts[index->num_entries - 1];
+    return 0;
+}
+
+/** Read up to `len` bytes at `offset`, retrying after short reads and signals.
+  *
+  * \return The number of bytes read, which is less than `len` only at the end of the
+  *     file, or -1 on failure (with `errno` set)
+  */
+static ssize_t pread_full(int fd, uint8_t *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, (off_t) (offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) done;
+}
+
+int cipher_decrypt_range(const struct cipher_ctx *ctx, const struct seek_index *index,
+                         int in_fd, uint64_t offset, uint64_t length, int out_fd,
+                         int num_threads) {
+    uint64_t pos = 0;
+    size_t key_index = 0;
+
+    if (index != NULL) {
+        struct stat st;
+        if (fstat(in_fd, &st) != 0) {
+            return -1;
+        }
+        if (index->low != ctx->low || index->high != ctx->high
+            || (uint64_t) st.st_size != index->size) {
+            errno = EINVAL;
+            return -1;
+        }
+        uint64_t i = offset / index->interval;
+        i = i < index->num_entries ? i : index->num_entries - 1;
+        pos = i * index->interval;
+        key_index = (size_t) index->counts[i];
+    }
+
+    num_threads = num_threads < 1 ? 1 : num_threads;
+    size_t buf_size = (size_t) CIPHER_STREAM_CHUNK * num_threads;
+    uint8_t *buf = malloc(buf_size);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    /* Catch the key up from the checkpoint to `offset`; this is the only part of the
+     * input before the range that is read. */
+    int result = 0;
+    while (pos < offset) {
+        size_t want = offset - pos < buf_size ? (size_t) (offset - pos) : buf_size;
+        ssize_t n = pread_full(in_fd, buf, want, pos);
+        if (n <= 0) {
+            result = n < 0 ? -1 : 0;
+            length = 0;
+            break;
+        }
+        key_index += count_in_range((char) ctx->low, (char) ctx->high, buf, (size_t) n);
+        pos += (uint64_t) n;
+    }
+
+    while (length > 0) {
+        size_t want = length < buf_size ? (size_t) length : buf_size;
+        ssize_t n = pread_full(in_fd, buf, want, pos);
+        if (n <= 0) {
+            result = n < 0 ? -1 : 0;
+            break;
+        }
+        key_index = cipher_ctx_apply_parallel(ctx, key_index, buf, (size_t) n, buf,
+                                              num_threads);
+        if (write_all(out_fd, buf, (size_t) n) != 0) {
+            result = -1;
+            break;
+        }
+        pos += (uint64_t) n;
+        length -= (uint64_t) n;
+    }
+
+    int saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+    return result;
+}
@@ -0,0 +1,494 @@
+#include "crypto.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/** Sentinel meaning "not yet detected"; never returned by `simd_level`.
+  */
+#define SIMD_UNKNOWN (-1)
+
+static int detected_level = SIMD_UNKNOWN;
+
+enum simd_level simd_level(void) {
+    int level = __atomic_load_n(&detected_level, __ATOMIC_RELAXED);
+    if (level != SIMD_UNKNOWN) {
+        return (enum simd_level) level;
+    }
+
+    level = SIMD_NONE;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        level = SIMD_AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        level = SIMD_AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        level = SIMD_SSSE3;
+    } else if (__builtin_cpu_supports("sse2")) {
+        level = SIMD_SSE2;
+    }
+#endif
+    TRACE(1, "detected SIMD level %d\n", level);
+    __atomic_store_n(&detected_level, level, __ATOMIC_RELAXED);
+    return (enum simd_level) level;
+}
+
+void simd_set_level(enum simd_level level) {
+    enum simd_level supported;
+
+    __atomic_store_n(&detected_level, SIMD_UNKNOWN, __ATOMIC_RELAXED);
+    supported = simd_level();
+    if (level < supported) {
+        __atomic_store_n(&detected_level, (int) level, __ATOMIC_RELAXED);
+    }
+}
+
+/* The Caesar kernels below all use the same branch-free formulation. With
+ * t = c - low (mod 256), a byte is in range iff t <= range_size - 1, and rotating it
+ * wraps past range_high iff t >= range_size - shift. Since low + t == c, the output is
+ *
+ *     c + (in_range ? (wraps ? shift - range_size : shift) : 0)      (mod 256)
+ *
+ * which only needs unsigned min/max, compares and byte adds. The caller guarantees
+ * 0 < shift < range_size, so range_size - shift fits in a byte. */
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t caesar_sse2(uint8_t low, int range_size, int shift,
+                          const uint8_t *in, size_t len, uint8_t *out) {
+    const __m128i v_low = _mm_set1_epi8((char) low);
+    const __m128i v_last = _mm_set1_epi8((char) (range_size - 1));
+    const __m128i v_wrap_at = _mm_set1_epi8((char) (range_size - shift));
+    const __m128i v_shift = _mm_set1_epi8((char) shift);
+    const __m128i v_size = _mm_set1_epi8((char) range_size);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128i t = _mm_sub_epi8(c, v_low);
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(t, v_last), t);
+        __m128i wraps = _mm_cmpeq_epi8(_mm_max_epu8(t, v_wrap_at), t);
+        __m128i delta = _mm_sub_epi8(v_shift, _mm_and_si128(wraps, v_size));
+        c = _mm_add_epi8(c, _mm_and_si128(in_range, delta));
+        _mm_storeu_si128((__m128i *) (out + i), c);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t caesar_avx2(uint8_t low, int range_size, int shift,
+                          const uint8_t *in, size_t len, uint8_t *out) {
+    const __m256i v_low = _mm256_set1_epi8((char) low);
+    const __m256i v_last = _mm256_set1_epi8((char) (range_size - 1));
+    const __m256i v_wrap_at = _mm256_set1_epi8((char) (range_size - shift));
+    const __m256i v_shift = _mm256_set1_epi8((char) shift);
+    const __m256i v_size = _mm256_set1_epi8((char) range_size);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (in + i));
+        __m256i t = _mm256_sub_epi8(c, v_low);
+        __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(t, v_last), t);
+        __m256i wraps = _mm256_cmpeq_epi8(_mm256_max_epu8(t, v_wrap_at), t);
+        __m256i delta = _mm256_sub_epi8(v_shift, _mm256_and_si256(wraps, v_size));
+        c = _mm256_add_epi8(c, _mm256_and_si256(in_range, delta));
+        _mm256_storeu_si256((__m256i *) (out + i), c);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t caesar_avx512(uint8_t low, int range_size, int shift,
+                            const uint8_t *in, size_t len, uint8_t *out) {
+    const __m512i v_low = _mm512_set1_epi8((char) low);
+    const __m512i v_last = _mm512_set1_epi8((char) (range_size - 1));
+    const __m512i v_wrap_at = _mm512_set1_epi8((char) (range_size - shift));
+    const __m512i v_shift = _mm512_set1_epi8((char) shift);
+    const __m512i v_wrapped = _mm512_set1_epi8((char) (shift - range_size));
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m512i c = _mm512_loadu_si512((const void *) (in + i));
+        __m512i t = _mm512_sub_epi8(c, v_low);
+        __mmask64 in_range = _mm512_cmple_epu8_mask(t, v_last);
+        __mmask64 wraps = _mm512_cmpge_epu8_mask(t, v_wrap_at);
+        __m512i delta = _mm512_mask_blend_epi8(wraps, v_shift, v_wrapped);
+        c = _mm512_mask_add_epi8(c, in_range, c, delta);
+        _mm512_storeu_si512((void *) (out + i), c);
+    }
+    return i;
+}
+
+#endif
+
+size_t caesar_simd(uint8_t low, int range_size, int shift,
+                   const uint8_t *in, size_t len, uint8_t *out) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return caesar_avx512(low, range_size, shift, in, len, out);
+    case SIMD_AVX2:
+        return caesar_avx2(low, range_size, shift, in, len, out);
+    case SIMD_SSSE3:
+    case SIMD_SSE2:
+        return caesar_sse2(low, range_size, shift, in, len, out);
+    case SIMD_NONE:
+        break;
+    }
+#else
+    (void) low;
+    (void) range_size;
+    (void) shift;
+    (void) in;
+    (void) len;
+    (void) out;
+#endif
+    return 0;
+}
+
+/* The Vigenere kernels apply a different shift to each in-range byte: the shift at
+ * position (pos + n) of the `shifts` schedule, where n is the number of in-range bytes
+ * before it. Within each 128-bit lane, n is an exclusive prefix sum of the in-range
+ * mask (four shift-and-add steps), which is used as a pshufb index into the 16 schedule
+ * entries starting at that lane's position. The lane's position is the previous lane's
+ * position plus the popcount of the previous lane's mask.
+ *
+ * The wrap-around uses the same trick as the Caesar kernels, with range_size - k
+ * computed per lane. (When range_size is 256 it truncates to 0 as a byte, and so does
+ * the correction; every byte is in range and the shift is simply added.) */
+
+/** Advance a schedule position by `count` in-range bytes.
+  */
+static inline size_t advance(size_t pos, unsigned count, size_t period) {
+    pos += count;
+    return pos >= period ? pos - period : pos;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("ssse3")))
+static size_t vigenere_ssse3(uint8_t low, int range_size, const uint8_t *shifts,
+                             size_t period, size_t *pos,
+                             const uint8_t *in, size_t len, uint8_t *out) {
+    const __m128i v_low = _mm_set1_epi8((char) low);
+    const __m128i v_last = _mm_set1_epi8((char) (range_size - 1));
+    const __m128i v_size = _mm_set1_epi8((char) range_size);
+    const __m128i zero = _mm_setzero_si128();
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128i t = _mm_sub_epi8(c, v_low);
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(t, v_last), t);
+        unsigned mask = (unsigned) _mm_movemask_epi8(in_range);
+
+        __m128i ones = _mm_sub_epi8(zero, in_range);
+        __m128i prefix = _mm_add_epi8(ones, _mm_slli_si128(ones, 1));
+        prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 2));
+        prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 4));
+        prefix = _mm_add_epi8(prefix, _mm_slli_si128(prefix, 8));
+        prefix = _mm_sub_epi8(prefix, ones);
+
+        __m128i window = _mm_loadu_si128((const __m128i *) (shifts + p));
+        __m128i k = _mm_shuffle_epi8(window, prefix);
+        __m128i wraps = _mm_cmpeq_epi8(_mm_max_epu8(t, _mm_sub_epi8(v_size, k)), t);
+        __m128i delta = _mm_sub_epi8(k, _mm_and_si128(wraps, v_size));
+        c = _mm_add_epi8(c, _mm_and_si128(in_range, delta));
+        _mm_storeu_si128((__m128i *) (out + i), c);
+
+        p = advance(p, (unsigned) __builtin_popcount(mask), period);
+    }
+    *pos = p;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t vigenere_avx2(uint8_t low, int range_size, const uint8_t *shifts,
+                            size_t period, size_t *pos,
+                            const uint8_t *in, size_t len, uint8_t *out) {
+    const __m256i v_low = _mm256_set1_epi8((char) low);
+    const __m256i v_last = _mm256_set1_epi8((char) (range_size - 1));
+    const __m256i v_size = _mm256_set1_epi8((char) range_size);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (in + i));
+        __m256i t = _mm256_sub_epi8(c, v_low);
+        __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(t, v_last), t);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(in_range);
+
+        __m256i ones = _mm256_sub_epi8(zero, in_range);
+        __m256i prefix = _mm256_add_epi8(ones, _mm256_slli_si256(ones, 1));
+        prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 2));
+        prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 4));
+        prefix = _mm256_add_epi8(prefix, _mm256_slli_si256(prefix, 8));
+        prefix = _mm256_sub_epi8(prefix, ones);
+
+        size_t p1 = advance(p, (unsigned) __builtin_popcount(mask & 0xffff), period);
+        __m256i window = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (shifts + p))),
+            _mm_loadu_si128((const __m128i *) (shifts + p1)), 1);
+        __m256i k = _mm256_shuffle_epi8(window, prefix);
+        __m256i wraps = _mm256_cmpeq_epi8(_mm256_max_epu8(t, _mm256_sub_epi8(v_size, k)), t);
+        __m256i delta = _mm256_sub_epi8(k, _mm256_and_si256(wraps, v_size));
+        c = _mm256_add_epi8(c, _mm256_and_si256(in_range, delta));
+        _mm256_storeu_si256((__m256i *) (out + i), c);
+
+        p = advance(p1, (unsigned) __builtin_popcount(mask >> 16), period);
+    }
+    *pos = p;
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t vigenere_avx512(uint8_t low, int range_size, const uint8_t *shifts,
+                              size_t period, size_t *pos,
+                              const uint8_t *in, size_t len, uint8_t *out) {
+    const __m512i v_low = _mm512_set1_epi8((char) low);
+    const __m512i v_last = _mm512_set1_epi8((char) (range_size - 1));
+    const __m512i v_size = _mm512_set1_epi8((char) range_size);
+    const __m512i v_one = _mm512_set1_epi8(1);
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m512i c = _mm512_loadu_si512((const void *) (in + i));
+        __m512i t = _mm512_sub_epi8(c, v_low);
+        __mmask64 in_range = _mm512_cmple_epu8_mask(t, v_last);
+
+        __m512i ones = _mm512_maskz_mov_epi8(in_range, v_one);
+        __m512i prefix = _mm512_add_epi8(ones, _mm512_bslli_epi128(ones, 1));
+        prefix = _mm512_add_epi8(prefix, _mm512_bslli_epi128(prefix, 2));
+        prefix = _mm512_add_epi8(prefix, _mm512_bslli_epi128(prefix, 4));
+        prefix = _mm512_add_epi8(prefix, _mm512_bslli_epi128(prefix, 8));
+        prefix = _mm512_sub_epi8(prefix, ones);
+
+        size_t p1 = advance(p, (unsigned) __builtin_popcountll(in_range & 0xffff), period);
+        size_t p2 = advance(p1, (unsigned) __builtin_popcountll((in_range >> 16) & 0xffff), period);
+        size_t p3 = advance(p2, (unsigned) __builtin_popcountll((in_range >> 32) & 0xffff), period);
+        __m512i window = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *) (shifts + p)));
+        window = _mm512_inserti32x4(window, _mm_loadu_si128((const __m128i *) (shifts + p1)), 1);
+        window = _mm512_inserti32x4(window, _mm_loadu_si128((const __m128i *) (shifts + p2)), 2);
+        window = _mm512_inserti32x4(window, _mm_loadu_si128((const __m128i *) (shifts + p3)), 3);
+        __m512i k = _mm512_shuffle_epi8(window, prefix);
+        __mmask64 wraps = _mm512_cmpge_epu8_mask(t, _mm512_sub_epi8(v_size, k));
+        __m512i delta = _mm512_mask_sub_epi8(k, wraps, k, v_size);
+        c = _mm512_mask_add_epi8(c, in_range, c, delta);
+        _mm512_storeu_si512((void *) (out + i), c);
+
+        p = advance(p3, (unsigned) __builtin_popcountll(in_range >> 48), period);
+    }
+    *pos = p;
+    return i;
+}
+
+#endif
+
+size_t vigenere_simd(uint8_t low, int range_size, const uint8_t *shifts, size_t period,
+                     size_t *pos, const uint8_t *in, size_t len, uint8_t *out) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return vigenere_avx512(low, range_size, shifts, period, pos, in, len, out);
+    case SIMD_AVX2:
+        return vigenere_avx2(low, range_size, shifts, period, pos, in, len, out);
+    case SIMD_SSSE3:
+        return vigenere_ssse3(low, range_size, shifts, period, pos, in, len, out);
+    case SIMD_SSE2:
+    case SIMD_NONE:
+        break;
+    }
+#else
+    (void) low;
+    (void) range_size;
+    (void) shifts;
+    (void) period;
+    (void) pos;
+    (void) in;
+    (void) len;
+    (void) out;
+#endif
+    return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t count_sse2(uint8_t low, int range_size, const uint8_t *in, size_t len,
+                         size_t *count) {
+    const __m128i v_low = _mm_set1_epi8((char) low);
+    const __m128i v_last = _mm_set1_epi8((char) (range_size - 1));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        /* Byte counters are folded into 64-bit lanes before they can overflow. */
+        __m128i acc = _mm_setzero_si128();
+        for (int n = 0; n < 255 && i + 16 <= len; ++n, i += 16) {
+            __m128i t = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (in + i)), v_low);
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_min_epu8(t, v_last), t));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i *) sums, total);
+    *count += (size_t) (sums[0] + sums[1]);
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(uint8_t low, int range_size, const uint8_t *in, size_t len,
+                         size_t *count) {
+    const __m256i v_low = _mm256_set1_epi8((char) low);
+    const __m256i v_last = _mm256_set1_epi8((char) (range_size - 1));
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i t = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *) (in + i)), v_low);
+        __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(t, v_last), t);
+        n += (size_t) __builtin_popcount((unsigned) _mm256_movemask_epi8(in_range));
+    }
+    *count += n;
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t count_avx512(uint8_t low, int range_size, const uint8_t *in, size_t len,
+                           size_t *count) {
+    const __m512i v_low = _mm512_set1_epi8((char) low);
+    const __m512i v_last = _mm512_set1_epi8((char) (range_size - 1));
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m512i t = _mm512_sub_epi8(_mm512_loadu_si512((const void *) (in + i)), v_low);
+        n += (size_t) __builtin_popcountll(_mm512_cmple_epu8_mask(t, v_last));
+    }
+    *count += n;
+    return i;
+}
+
+#endif
+
+size_t count_in_range_simd(uint8_t low, int range_size, const uint8_t *in, size_t len,
+                           size_t *count) {
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return count_avx512(low, range_size, in, len, count);
+    case SIMD_AVX2:
+        return count_avx2(low, range_size, in, len, count);
+    case SIMD_SSSE3:
+    case SIMD_SSE2:
+        return count_sse2(low, range_size, in, len, count);
+    case SIMD_NONE:
+        break;
+    }
+#else
+    (void) low;
+    (void) range_size;
+    (void) in;
+    (void) len;
+    (void) count;
+#endif
+    return 0;
+}
+
+/* The block scans test a whole block for any in-range byte with one compare per vector
+ * and an OR across the block, so runs of blocks are classified at load bandwidth without
+ * writing anything. */
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(uint8_t low, int range_size, int busy, const uint8_t *in,
+                        size_t len) {
+    const __m128i v_low = _mm_set1_epi8((char) low);
+    const __m128i v_last = _mm_set1_epi8((char) (range_size - 1));
+    size_t i = 0;
+
+    for (; i + CIPHER_SCAN_BLOCK <= len; i += CIPHER_SCAN_BLOCK) {
+        __m128i any = _mm_setzero_si128();
+        for (int j = 0; j < CIPHER_SCAN_BLOCK; j += 16) {
+            __m128i t = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (in + i + j)), v_low);
+            any = _mm_or_si128(any, _mm_cmpeq_epi8(_mm_min_epu8(t, v_last), t));
+        }
+        if ((_mm_movemask_epi8(any) != 0) != busy) {
+            break;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(uint8_t low, int range_size, int busy, const uint8_t *in,
+                        size_t len) {
+    const __m256i v_low = _mm256_set1_epi8((char) low);
+    const __m256i v_last = _mm256_set1_epi8((char) (range_size - 1));
+    size_t i = 0;
+
+    for (; i + CIPHER_SCAN_BLOCK <= len; i += CIPHER_SCAN_BLOCK) {
+        __m256i any = _mm256_setzero_si256();
+        for (int j = 0; j < CIPHER_SCAN_BLOCK; j += 32) {
+            __m256i t = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *) (in + i + j)),
+                                        v_low);
+            any = _mm256_or_si256(any, _mm256_cmpeq_epi8(_mm256_min_epu8(t, v_last), t));
+        }
+        if ((_mm256_movemask_epi8(any) != 0) != busy) {
+            break;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t scan_avx512(uint8_t low, int range_size, int busy, const uint8_t *in,
+                          size_t len) {
+    const __m512i v_low = _mm512_set1_epi8((char) low);
+    const __m512i v_last = _mm512_set1_epi8((char) (range_size - 1));
+    size_t i = 0;
+
+    for (; i + CIPHER_SCAN_BLOCK <= len; i += CIPHER_SCAN_BLOCK) {
+        __m512i t = _mm512_sub_epi8(_mm512_loadu_si512((const void *) (in + i)), v_low);
+        if ((_mm512_cmple_epu8_mask(t, v_last) != 0) != busy) {
+            break;
+        }
+    }
+    return i;
+}
+
+#endif
+
+size_t scan_blocks_simd(uint8_t low, int range_size, int busy, const uint8_t *in,
+                        size_t len) {
+#ifdef HAVE_X86_SIMD
+    busy = busy != 0;
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return scan_avx512(low, range_size, busy, in, len);
+    case SIMD_AVX2:
+        return scan_avx2(low, range_size, busy, in, len);
+    case SIMD_SSSE3:
+    case SIMD_SSE2:
+        return scan_sse2(low, range_size, busy, in, len);
+    case SIMD_NONE:
+        break;
+    }
+#else
+    (void) low;
+    (void) range_size;
+    (void) busy;
+    (void) in;
+    (void) len;
+#endif
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "crypto.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void cipher_stream_init(struct cipher_stream *stream, const struct cipher_ctx *ctx) {
+    memset(stream, 0, sizeof(*stream));
+    stream->ctx = ctx;
+    stream->num_threads = 1;
+}
+
+void cipher_stream_init_multi(struct cipher_stream *stream, const struct multi_ctx *multi) {
+    memset(stream, 0, sizeof(*stream));
+    stream->multi = multi;
+    stream->num_threads = 1;
+}
+
+void cipher_stream_update(struct cipher_stream *stream, const uint8_t *in, size_t len,
+                          uint8_t *out) {
+    if (stream->multi != NULL) {
+        size_t *key_index = stream->multi->policy == KEY_PER_RANGE ? stream->range_key_index
+                                                                   : &stream->key_index;
+        multi_ctx_apply(stream->multi, key_index, in, len, out);
+        return;
+    }
+    stream->key_index = cipher_ctx_apply_parallel(stream->ctx, stream->key_index, in, len,
+                                                  out, stream->num_threads);
+    if (stream->index != NULL) {
+        seek_index_update(stream->index, out, len);
+    }
+}
+
+int write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+int cipher_stream_fd(struct cipher_stream *stream, int in_fd, int out_fd) {
+    int threads = stream->multi == NULL && stream->num_threads > 1 ? stream->num_threads : 1;
+    size_t buf_size = (size_t) CIPHER_STREAM_CHUNK * threads;
+    uint8_t *buf = malloc(buf_size);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    for (;;) {
+        ssize_t n = read(in_fd, buf, buf_size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        cipher_stream_update(stream, buf, (size_t) n, buf);
+        if (write_all(out_fd, buf, (size_t) n) != 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    int saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+    return result;
+}
+
+int keystream_fd(struct keystream *ks, int in_fd, int out_fd) {
+    uint8_t *buf = malloc(CIPHER_STREAM_CHUNK);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    for (;;) {
+        ssize_t n = read(in_fd, buf, CIPHER_STREAM_CHUNK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (keystream_update(ks, buf, (size_t) n, buf) != 0
+            || write_all(out_fd, buf, (size_t) n) != 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    int saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+    return result;
+}
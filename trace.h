@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/** Compile-time debug tracing.
+  *
+  * `TRACE(level, format, ...)` writes a `printf`-style message to stderr, prefixed with
+  * the source location, if the program was built with `-DCRYPTO_TRACE=n` for some
+  * `n >= level`. Level 1 is for per-call messages and level 2 for per-character ones.
+  *
+  * In a build without `CRYPTO_TRACE` the call is compiled out entirely (its arguments are
+  * still type-checked, but never evaluated), so traces cost nothing in release builds and
+  * may be left in hot loops.
+  *
+  * ## Example usage
+  *
+  * ```c
+  *   TRACE(1, "encrypting %zu bytes\n", len);
+  *   TRACE(2, "character %d -> %d\n", in[i], out[i]);
+  * ```
+  */
+#include <stdio.h>
+
+#ifdef CRYPTO_TRACE
+#define TRACE(level, ...)                                        \
+    do {                                                         \
+        if (CRYPTO_TRACE >= (level)) {                           \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+            fprintf(stderr, __VA_ARGS__);                        \
+        }                                                        \
+    } while (0)
+#else
+#define TRACE(level, ...)                                        \
+    do {                                                         \
+        if (0) {                                                 \
+            (void) (level);                                      \
+            printf(__VA_ARGS__);                                 \
+        }                                                        \
+    } while (0)
+#endif
+
+#endif
+// TRACE_H
+// vim: tw=90 :
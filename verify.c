@@ -0,0 +1,989 @@
+#define _GNU_SOURCE
+#include "crypto.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Longest key generated, long enough to exceed both the per-position table limit of
+  * `cipher_ctx_init` and the on-stack schedule limit of the `_buf` functions.
+  */
+#define VERIFY_MAX_KEY_LEN 1500
+
+/** Most pieces an input is split into for the chunked and record-based variants.
+  */
+#define VERIFY_MAX_PIECES 16
+
+static const char *const level_names[] = { "none", "sse2", "ssse3", "avx2", "avx512" };
+
+/** One set of arguments, applied by every implementation and by the reference.
+  */
+struct verify_case {
+    enum cipher_op op;
+    uint8_t low;
+    uint8_t high;
+    int shift;
+    const uint8_t *key;     /* followed by a null byte */
+    size_t key_len;
+    size_t key_index;
+    const uint8_t *in;
+    size_t len;
+};
+
+/** Buffers and progress of a verification run.
+  */
+struct verify_run {
+    uint8_t *in;
+    uint8_t *key;
+    uint8_t *expected;
+    uint8_t *out;
+    uint8_t *text;          /* null-terminated copies for the string functions */
+    uint8_t *text_out;
+    size_t max_len;
+    enum simd_level best;
+    uint64_t state;         /* drives the splits and thread counts */
+    uint64_t comparisons;
+    int failed;
+};
+
+/** The splitmix64 generator: every output of a seed is well mixed, so consecutive seeds
+  * give unrelated cases.
+  */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static uint64_t below(uint64_t *state, uint64_t n) {
+    return n == 0 ? 0 : next_random(state) % n;
+}
+
+static int is_vigenere(enum cipher_op op) {
+    return op == VIGENERE_ENCRYPT || op == VIGENERE_DECRYPT;
+}
+
+/** Reduce `n` to the range [0, size).
+  */
+static int modulo(int n, int size) {
+    return (n % size + size) % size;
+}
+
+/** The reference implementation: the semantics of the string functions, one byte at a
+  * time with no tables, vectors or precomputed shifts. Bytes are compared as unsigned,
+  * out-of-range bytes are copied and do not advance the key, and every shift is reduced
+  * modulo the size of the range.
+  *
+  * \return The key index after the last byte, reduced modulo the key length
+  */
+static size_t reference(const struct verify_case *c, const uint8_t *in, size_t len,
+                        size_t key_index, uint8_t *out) {
+    int size = c->high - c->low + 1;
+    int decrypt = c->op == CAESAR_DECRYPT || c->op == VIGENERE_DECRYPT;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t ch = in[i];
+        if (ch < c->low || ch > c->high) {
+            out[i] = ch;
+            continue;
+        }
+        int shift = c->shift;
+        if (is_vigenere(c->op)) {
+            shift = modulo(c->key[key_index % c->key_len] - c->low, size);
+            key_index++;
+        }
+        out[i] = (uint8_t) (c->low + modulo(ch - c->low + (decrypt ? -shift : shift), size));
+    }
+    return is_vigenere(c->op) ? key_index % c->key_len : key_index;
+}
+
+/** The reference for a `multi_ctx`: as `reference`, except that a byte is rotated within
+  * whichever of `ranges` holds it, and a key character's offset is read in that range.
+  */
+static void reference_multi(const struct verify_case *c, const struct cipher_range *ranges,
+                            int num_ranges, enum key_policy policy, uint8_t *out) {
+    size_t key_index[CIPHER_MAX_RANGES];
+    int decrypt = c->op == CAESAR_DECRYPT || c->op == VIGENERE_DECRYPT;
+
+    for (int r = 0; r < num_ranges; ++r) {
+        key_index[r] = c->key_index;
+    }
+    for (size_t i = 0; i < c->len; ++i) {
+        uint8_t ch = c->in[i];
+        int r = 0;
+        while (r < num_ranges && (ch < (uint8_t) ranges[r].low || ch > (uint8_t) ranges[r].high)) {
+            ++r;
+        }
+        out[i] = ch;
+        if (r == num_ranges) {
+            continue;
+        }
+        uint8_t low = (uint8_t) ranges[r].low;
+        int size = (uint8_t) ranges[r].high - low + 1;
+        int shift = c->shift;
+        if (is_vigenere(c->op)) {
+            size_t *k = &key_index[policy == KEY_PER_RANGE ? r : 0];
+            shift = modulo(c->key[*k % c->key_len] - low, size);
+            ++*k;
+        }
+        out[i] = (uint8_t) (low + modulo(ch - low + (decrypt ? -shift : shift), size));
+    }
+}
+
+/** The reference for an autokey cipher: as `reference`, except that once the key `c->key`
+  * is used up, the n-th in-range byte is shifted by the offset from `c->low` of the
+  * in-range plaintext byte `c->key_len` before it. `plain` receives those offsets.
+  */
+static void reference_autokey(const struct verify_case *c, uint8_t *plain, uint8_t *out) {
+    int size = c->high - c->low + 1;
+    int decrypt = c->op == VIGENERE_DECRYPT;
+    size_t n = 0;
+
+    for (size_t i = 0; i < c->len; ++i) {
+        uint8_t ch = c->in[i];
+        if (ch < c->low || ch > c->high) {
+            out[i] = ch;
+            continue;
+        }
+        int shift = n < c->key_len ? modulo(c->key[n] - c->low, size) : plain[n - c->key_len];
+        out[i] = (uint8_t) (c->low + modulo(ch - c->low + (decrypt ? -shift : shift), size));
+        plain[n++] = (uint8_t) ((decrypt ? out[i] : ch) - c->low);
+    }
+}
+
+/** Report the first difference between `expected` and `actual` as a failure of
+  * `variant`. Nothing is checked once the run has failed, so only the first failure is
+  * reported.
+  */
+static void check(struct verify_run *run, const struct verify_case *c, const char *variant,
+                  const uint8_t *expected, const uint8_t *actual, size_t len) {
+    if (run->failed) {
+        return;
+    }
+    run->comparisons++;
+    for (size_t i = 0; i < len; ++i) {
+        if (expected[i] != actual[i]) {
+            fprintf(stderr, "Error: %s differs from the reference at byte %zu of %zu "
+                    "(input %d, expected %d, got %d).\n", variant, i, len, c->in[i],
+                    expected[i], actual[i]);
+            run->failed = 1;
+            return;
+        }
+    }
+}
+
+/** Report a failure of `variant` if it reached a different key index or count.
+  */
+static void check_value(struct verify_run *run, const char *variant, const char *what,
+                        uint64_t expected, uint64_t actual) {
+    if (run->failed) {
+        return;
+    }
+    run->comparisons++;
+    if (expected != actual) {
+        fprintf(stderr, "Error: %s gives %s %llu, where the reference gives %llu.\n",
+                variant, what, (unsigned long long) actual, (unsigned long long) expected);
+        run->failed = 1;
+    }
+}
+
+/** Fill `out` with bytes that all differ from `expected`, so that a variant which leaves
+  * some of its output unwritten cannot pass on what an earlier variant left there.
+  */
+static void poison(uint8_t *out, const uint8_t *expected, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        out[i] = (uint8_t) ~expected[i];
+    }
+}
+
+/** Describe a case on stderr, after a failure.
+  */
+static void print_case(const struct verify_case *c) {
+    fprintf(stderr, "  %s, range %d..%d, ", cipher_op_name(c->op), c->low, c->high);
+    if (is_vigenere(c->op)) {
+        fprintf(stderr, "key index %zu, key of %zu bytes:", c->key_index, c->key_len);
+        for (size_t i = 0; i < c->key_len && i < 32; ++i) {
+            fprintf(stderr, " %02x", c->key[i]);
+        }
+        fprintf(stderr, "%s, ", c->key_len > 32 ? " ..." : "");
+    } else {
+        fprintf(stderr, "shift %d, ", c->shift);
+    }
+    fprintf(stderr, "%zu bytes of input\n", c->len);
+}
+
+/** Apply the `_buf` function for `c->op`.
+  *
+  * \return The key index reached, as for `reference`
+  */
+static size_t apply_buf(const struct verify_case *c, const uint8_t *in, size_t len,
+                        size_t key_index, uint8_t *out) {
+    char low = (char) c->low;
+    char high = (char) c->high;
+
+    switch (c->op) {
+    case CAESAR_ENCRYPT:
+        caesar_encrypt_buf(low, high, c->shift, in, len, out);
+        return key_index;
+    case CAESAR_DECRYPT:
+        caesar_decrypt_buf(low, high, c->shift, in, len, out);
+        return key_index;
+    case VIGENERE_ENCRYPT:
+        return vigenere_encrypt_buf(low, high, c->key, c->key_len, key_index, in, len, out);
+    default:
+        return vigenere_decrypt_buf(low, high, c->key, c->key_len, key_index, in, len, out);
+    }
+}
+
+/** Cut `len` into between 1 and `VERIFY_MAX_PIECES` pieces (some possibly empty), given
+  * as `num + 1` increasing offsets from 0 to `len`.
+  *
+  * \return The number of pieces
+  */
+static size_t split(struct verify_run *run, size_t len, size_t offsets[VERIFY_MAX_PIECES + 1]) {
+    size_t num = 1 + below(&run->state, VERIFY_MAX_PIECES);
+
+    offsets[0] = 0;
+    offsets[num] = len;
+    for (size_t i = 1; i < num; ++i) {
+        size_t cut = below(&run->state, len + 1);
+        size_t j = i;
+        for (; j > 1 && offsets[j - 1] > cut; --j) {
+            offsets[j] = offsets[j - 1];
+        }
+        offsets[j] = cut;
+    }
+    return num;
+}
+
+/** Check the `_buf` functions and `cipher_ctx_apply` at every SIMD level the CPU
+  * supports, whole and in place.
+  */
+static void verify_levels(struct verify_run *run, const struct verify_case *c,
+                          const struct cipher_ctx *ctx, size_t expected_key) {
+    char name[32];
+
+    for (int level = SIMD_NONE; level <= (int) run->best; ++level) {
+        simd_set_level((enum simd_level) level);
+
+        snprintf(name, sizeof(name), "buf/%s", level_names[level]);
+        size_t key_index = apply_buf(c, c->in, c->len, c->key_index, run->out);
+        check(run, c, name, run->expected, run->out, c->len);
+        check_value(run, name, "key index", expected_key, key_index);
+
+        snprintf(name, sizeof(name), "ctx/%s", level_names[level]);
+        key_index = cipher_ctx_apply(ctx, c->key_index, c->in, c->len, run->out);
+        check(run, c, name, run->expected, run->out, c->len);
+        if (is_vigenere(c->op)) {
+            check_value(run, name, "key index", expected_key, key_index);
+        }
+
+        snprintf(name, sizeof(name), "ctx-in-place/%s", level_names[level]);
+        memcpy(run->out, c->in, c->len);
+        cipher_ctx_apply(ctx, c->key_index, run->out, c->len, run->out);
+        check(run, c, name, run->expected, run->out, c->len);
+
+        struct cipher_ctx sparse = *ctx;
+        sparse.sparse = 1;
+        snprintf(name, sizeof(name), "ctx-sparse/%s", level_names[level]);
+        poison(run->out, run->expected, c->len);
+        key_index = cipher_ctx_apply(&sparse, c->key_index, c->in, c->len, run->out);
+        check(run, c, name, run->expected, run->out, c->len);
+        if (is_vigenere(c->op)) {
+            check_value(run, name, "key index", expected_key, key_index);
+        }
+
+        snprintf(name, sizeof(name), "ctx-sparse-in-place/%s", level_names[level]);
+        memcpy(run->out, c->in, c->len);
+        cipher_ctx_apply(&sparse, c->key_index, run->out, c->len, run->out);
+        check(run, c, name, run->expected, run->out, c->len);
+    }
+    simd_set_level(run->best);
+}
+
+/** Check the variants that split the input: the `_buf` functions and a stream fed in
+  * pieces, threads, and batches of records with and without a continuing key.
+  */
+static void verify_pieces(struct verify_run *run, const struct verify_case *c,
+                          const struct cipher_ctx *ctx, size_t expected_key) {
+    size_t offsets[VERIFY_MAX_PIECES + 1];
+    size_t num = split(run, c->len, offsets);
+    int vigenere = is_vigenere(c->op);
+
+    size_t key_index = c->key_index;
+    for (size_t i = 0; i < num; ++i) {
+        key_index = apply_buf(c, c->in + offsets[i], offsets[i + 1] - offsets[i], key_index,
+                              run->out + offsets[i]);
+    }
+    check(run, c, "buf-pieces", run->expected, run->out, c->len);
+    check_value(run, "buf-pieces", "key index", expected_key, key_index);
+
+    struct cipher_stream stream;
+    cipher_stream_init(&stream, ctx);
+    stream.key_index = c->key_index;
+    stream.num_threads = 1 + (int) below(&run->state, 4);
+    for (size_t i = 0; i < num; ++i) {
+        cipher_stream_update(&stream, c->in + offsets[i], offsets[i + 1] - offsets[i],
+                             run->out + offsets[i]);
+    }
+    check(run, c, "stream", run->expected, run->out, c->len);
+    if (vigenere) {
+        check_value(run, "stream", "key index", expected_key, stream.key_index % c->key_len);
+    }
+
+    key_index = cipher_ctx_apply_parallel(ctx, c->key_index, c->in, c->len, run->out,
+                                          2 + (int) below(&run->state, 7));
+    check(run, c, "threaded", run->expected, run->out, c->len);
+    if (vigenere) {
+        check_value(run, "threaded", "key index", expected_key, key_index);
+    }
+
+    cipher_ctx_apply_packed(ctx, c->key_index, c->in, offsets, num, run->out, 1);
+    check(run, c, "packed", run->expected, run->out, c->len);
+
+    /* Without a continuing key every record starts again at the same key index. */
+    for (size_t i = 0; i < num; ++i) {
+        reference(c, c->in + offsets[i], offsets[i + 1] - offsets[i], c->key_index,
+                  run->expected + offsets[i]);
+    }
+    struct cipher_span spans[VERIFY_MAX_PIECES];
+    for (size_t i = 0; i < num; ++i) {
+        spans[i].in = c->in + offsets[i];
+        spans[i].out = run->out + offsets[i];
+        spans[i].len = offsets[i + 1] - offsets[i];
+    }
+    cipher_ctx_apply_batch(ctx, c->key_index, spans, num, 0);
+    check(run, c, "batch", run->expected, run->out, c->len);
+    reference(c, c->in, c->len, c->key_index, run->expected);
+
+    /* The checkpoints of a seek index are the key index plus the in-range count so far. */
+    struct seek_index index;
+    uint64_t interval = 1 + below(&run->state, c->len + 1);
+    if (seek_index_init(&index, (char) c->low, (char) c->high, interval, c->key_index) == 0) {
+        for (size_t i = 0; i < num; ++i) {
+            seek_index_update(&index, c->in + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+        check_value(run, "seek-index", "checkpoints", c->len / interval + 1, index.num_entries);
+        uint64_t count = c->key_index;
+        for (size_t i = 0, e = 0; i <= c->len && e < index.num_entries; ++i) {
+            if (i % interval == 0) {
+                check_value(run, "seek-index", "checkpoint", count, index.counts[e++]);
+            }
+            count += i < c->len && c->in[i] >= c->low && c->in[i] <= c->high;
+        }
+        seek_index_free(&index);
+    }
+}
+
+/** Check `multi_ctx_apply` with the range of `c` alone, and with a second range added
+  * next to it, under both key policies.
+  */
+static void verify_multi(struct verify_run *run, const struct verify_case *c) {
+    struct cipher_range ranges[2] = { { (char) c->low, (char) c->high } };
+    struct multi_ctx multi;
+    size_t key_index[CIPHER_MAX_RANGES];
+
+    if (multi_ctx_init(&multi, c->op, ranges, 1, c->shift, c->key, c->key_len, KEY_SHARED) == 0) {
+        key_index[0] = c->key_index;
+        multi_ctx_apply(&multi, key_index, c->in, c->len, run->out);
+        check(run, c, "multi", run->expected, run->out, c->len);
+        multi.sparse = 1;
+        key_index[0] = c->key_index;
+        poison(run->out, run->expected, c->len);
+        multi_ctx_apply(&multi, key_index, c->in, c->len, run->out);
+        check(run, c, "multi-sparse", run->expected, run->out, c->len);
+        multi_ctx_free(&multi);
+    }
+
+    /* A second range of at least two characters, below or above the first. */
+    if (c->low >= 2 && (c->high > 253 || below(&run->state, 2) == 0)) {
+        uint8_t high = (uint8_t) below(&run->state, c->low - 1) + 1;
+        ranges[1].low = (char) below(&run->state, high);
+        ranges[1].high = (char) high;
+    } else if (c->high <= 253) {
+        uint8_t low = (uint8_t) (c->high + 1 + below(&run->state, 254 - c->high));
+        ranges[1].low = (char) low;
+        ranges[1].high = (char) (low + 1 + below(&run->state, 255 - low));
+    } else {
+        return;
+    }
+    if (below(&run->state, 2) == 0) {
+        struct cipher_range first = ranges[0];
+        ranges[0] = ranges[1];
+        ranges[1] = first;
+    }
+
+    for (int policy = KEY_SHARED; policy <= KEY_PER_RANGE; ++policy) {
+        const char *name = policy == KEY_SHARED ? "multi-shared" : "multi-per-range";
+        if (multi_ctx_init(&multi, c->op, ranges, 2, c->shift, c->key, c->key_len,
+                           (enum key_policy) policy) != 0) {
+            fprintf(stderr, "Error: %s: %s\n", name, strerror(errno));
+            run->failed = 1;
+            return;
+        }
+        key_index[0] = key_index[1] = c->key_index;
+        multi_ctx_apply(&multi, key_index, c->in, c->len, run->out);
+        reference_multi(c, ranges, 2, (enum key_policy) policy, run->expected);
+        check(run, c, name, run->expected, run->out, c->len);
+        size_t plain_index[2] = { key_index[0], key_index[1] };
+
+        /* In place, so blocks the sparse scan skips are never written. */
+        const char *sparse_name = policy == KEY_SHARED ? "multi-shared-sparse"
+                                                       : "multi-per-range-sparse";
+        multi.sparse = 1;
+        key_index[0] = key_index[1] = c->key_index;
+        memcpy(run->out, c->in, c->len);
+        multi_ctx_apply(&multi, key_index, run->out, c->len, run->out);
+        check(run, c, sparse_name, run->expected, run->out, c->len);
+        for (int r = 0; r < 2; ++r) {
+            check_value(run, sparse_name, "key index", plain_index[r], key_index[r]);
+        }
+        multi_ctx_free(&multi);
+    }
+    reference(c, c->in, c->len, c->key_index, run->expected);
+}
+
+/** Write a running key for `c` to a temporary file or, if it fits in the pipe buffer, a
+  * pipe: the key of `c` written out from `c->key_index` for `count` characters, with
+  * out-of-range bytes between them if `filter` is set.
+  *
+  * \return A file descriptor to read the key from, or -1 on failure (with `errno` set)
+  */
+static int write_running_key(struct verify_run *run, const struct verify_case *c,
+                             size_t count, int filter) {
+    int size = c->high - c->low + 1;
+    int use_pipe = count < 4096 && below(&run->state, 2) == 0;
+    int fds[2];
+    FILE *file = NULL;
+
+    if (use_pipe ? pipe(fds) != 0 : (file = tmpfile()) == NULL) {
+        return -1;
+    }
+    uint8_t *key = run->text;
+    size_t len = 0;
+    for (size_t n = 0; n < count; ++n) {
+        uint8_t k = c->key[(c->key_index + n) % c->key_len];
+        if (filter) {
+            /* Reduced into the range, so the filter keeps it with the same shift. */
+            k = (uint8_t) (c->low + modulo(k - c->low, size));
+            if (below(&run->state, 4) == 0) {
+                key[len++] = (uint8_t) (c->high + 1 + below(&run->state, 255 - size));
+            }
+        }
+        key[len++] = k;
+        if (len + 2 > run->max_len || n + 1 == count) {
+            int ok = use_pipe ? write(fds[1], key, len) == (ssize_t) len
+                              : fwrite(key, len, 1, file) == 1;
+            if (!ok && use_pipe) {
+                close(fds[0]);
+                close(fds[1]);
+                return -1;
+            }
+            if (!ok) {
+                fclose(file);
+                return -1;
+            }
+            len = 0;
+        }
+    }
+    if (use_pipe) {
+        close(fds[1]);
+        return fds[0];
+    }
+    /* The descriptor outlives the stream; the file is deleted once both are closed. */
+    int fd = dup(fileno(file));
+    fclose(file);
+    if (fd >= 0 && lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** Check the running-key and autokey ciphers, fed in pieces at a random SIMD level. A
+  * running key holding the repeating key written out should give the same result as the
+  * repeating key, and one character too short should run out.
+  */
+static void verify_keystream(struct verify_run *run, const struct verify_case *c) {
+    size_t offsets[VERIFY_MAX_PIECES + 1];
+    size_t num = split(run, c->len, offsets);
+    size_t count = count_in_range((char) c->low, (char) c->high, c->in, c->len);
+    int filter = c->high - c->low < 255 && below(&run->state, 2) == 0;
+    int short_key = count > 0 && below(&run->state, 8) == 0;
+    struct keystream ks;
+    int error = 0;
+
+    simd_set_level((enum simd_level) below(&run->state, run->best + 1));
+    int key_fd = write_running_key(run, c, count - short_key, filter);
+    if (key_fd < 0
+        || keystream_init_running(&ks, c->op, (char) c->low, (char) c->high, key_fd,
+                                  filter) != 0) {
+        fprintf(stderr, "Error: keystream_init_running: %s\n", strerror(errno));
+        run->failed = 1;
+    } else {
+        for (size_t i = 0; i < num && error == 0; ++i) {
+            if (keystream_update(&ks, c->in + offsets[i], offsets[i + 1] - offsets[i],
+                                 run->out + offsets[i]) != 0) {
+                error = errno;
+            }
+        }
+        if (short_key) {
+            check_value(run, "running-key", "error", ENODATA, (uint64_t) error);
+        } else {
+            check_value(run, "running-key", "error", 0, (uint64_t) error);
+            check(run, c, "running-key", run->expected, run->out, c->len);
+        }
+        keystream_free(&ks);
+    }
+    if (key_fd >= 0) {
+        close(key_fd);
+    }
+
+    reference_autokey(c, run->text, run->expected);
+    if (keystream_init_autokey(&ks, c->op, (char) c->low, (char) c->high, c->key,
+                               c->key_len) != 0) {
+        fprintf(stderr, "Error: keystream_init_autokey: %s\n", strerror(errno));
+        run->failed = 1;
+    } else {
+        for (size_t i = 0; i < num; ++i) {
+            keystream_update(&ks, c->in + offsets[i], offsets[i + 1] - offsets[i],
+                             run->out + offsets[i]);
+        }
+        check(run, c, "autokey", run->expected, run->out, c->len);
+        keystream_free(&ks);
+    }
+
+    /* The inverse operation restores the input. */
+    enum cipher_op inverse = c->op == VIGENERE_ENCRYPT ? VIGENERE_DECRYPT : VIGENERE_ENCRYPT;
+    if (keystream_init_autokey(&ks, inverse, (char) c->low, (char) c->high, c->key,
+                               c->key_len) == 0) {
+        keystream_update(&ks, run->expected, c->len, run->out);
+        check(run, c, "autokey-round-trip", c->in, run->out, c->len);
+        keystream_free(&ks);
+    }
+    simd_set_level(run->best);
+    reference(c, c->in, c->len, c->key_index, run->expected);
+}
+
+/** Check the string functions, where the case can be expressed as strings.
+  */
+static void verify_strings(struct verify_run *run, const struct verify_case *c) {
+    if (c->key_index != 0 || memchr(c->in, 0, c->len) != NULL
+        || (is_vigenere(c->op) && memchr(c->key, 0, c->key_len) != NULL)) {
+        return;
+    }
+    char *text = (char *) run->text;
+    char *out = (char *) run->text_out;
+    memcpy(text, c->in, c->len);
+    text[c->len] = '\0';
+    out[c->len] = 'x';
+
+    switch (c->op) {
+    case CAESAR_ENCRYPT:
+        caesar_encrypt((char) c->low, (char) c->high, c->shift, text, out);
+        break;
+    case CAESAR_DECRYPT:
+        caesar_decrypt((char) c->low, (char) c->high, c->shift, text, out);
+        break;
+    case VIGENERE_ENCRYPT:
+        vigenere_encrypt((char) c->low, (char) c->high, (const char *) c->key, text, out);
+        break;
+    default:
+        vigenere_decrypt((char) c->low, (char) c->high, (const char *) c->key, text, out);
+        break;
+    }
+    check(run, c, "string", run->expected, run->text_out, c->len);
+    check_value(run, "string", "terminator", 0, (uint8_t) out[c->len]);
+}
+
+/** Check that the inverse operation restores the input, both in the reference and in
+  * `cipher_ctx_apply`.
+  */
+static void verify_round_trip(struct verify_run *run, const struct verify_case *c) {
+    static const enum cipher_op inverse_op[] = {
+        [CAESAR_ENCRYPT] = CAESAR_DECRYPT,
+        [CAESAR_DECRYPT] = CAESAR_ENCRYPT,
+        [VIGENERE_ENCRYPT] = VIGENERE_DECRYPT,
+        [VIGENERE_DECRYPT] = VIGENERE_ENCRYPT,
+    };
+    struct verify_case inverse = *c;
+    inverse.op = inverse_op[c->op];
+    inverse.in = run->expected;
+
+    reference(&inverse, run->expected, c->len, c->key_index, run->out);
+    check(run, c, "reference-round-trip", c->in, run->out, c->len);
+
+    struct cipher_ctx ctx;
+    if (cipher_ctx_init(&ctx, inverse.op, (char) c->low, (char) c->high, c->shift, c->key,
+                        c->key_len) == 0) {
+        cipher_ctx_apply(&ctx, c->key_index, run->expected, c->len, run->out);
+        check(run, c, "round-trip", c->in, run->out, c->len);
+        cipher_ctx_free(&ctx);
+    }
+}
+
+/** Run every variant on one case.
+  *
+  * \return 0 if all of them agree with the reference, or -1 (after describing the case
+  *     on stderr) if not
+  */
+static int verify_case(struct verify_run *run, const struct verify_case *c) {
+    struct cipher_ctx ctx;
+    size_t expected_key = reference(c, c->in, c->len, c->key_index, run->expected);
+
+    if (cipher_ctx_init(&ctx, c->op, (char) c->low, (char) c->high, c->shift, c->key,
+                        c->key_len) != 0) {
+        fprintf(stderr, "Error: cipher_ctx_init: %s\n", strerror(errno));
+        run->failed = 1;
+    } else {
+        verify_levels(run, c, &ctx, expected_key);
+        verify_pieces(run, c, &ctx, expected_key);
+        cipher_ctx_free(&ctx);
+    }
+    verify_multi(run, c);
+    if (is_vigenere(c->op)) {
+        verify_keystream(run, c);
+    }
+    verify_strings(run, c);
+    verify_round_trip(run, c);
+
+    if (run->failed) {
+        print_case(c);
+        return -1;
+    }
+    return 0;
+}
+
+/** Run the fixed cases that random inputs rarely produce: an empty input, and one of
+  * UTF-8 text with nothing in range, which the sparse scan skips entirely. Each starts
+  * from a key index past the end of the key, which must still come back reduced.
+  *
+  * \return 0 if every variant agrees with the reference, or -1 (after describing the
+  *     case on stderr) if not
+  */
+static int verify_edge_cases(struct verify_run *run) {
+    static const uint8_t euro[] = { 0xe2, 0x82, 0xac, ' ' };
+    size_t len = run->max_len < 4096 ? run->max_len : 4096;
+
+    memcpy(run->key, "KEY", 4);
+    for (size_t i = 0; i < len; ++i) {
+        run->in[i] = euro[i % sizeof(euro)];
+    }
+    for (int op = CAESAR_ENCRYPT; op <= VIGENERE_DECRYPT; ++op) {
+        for (int empty = 1; empty >= 0; --empty) {
+            struct verify_case c = {
+                .op = (enum cipher_op) op, .low = 'A', .high = 'Z', .shift = 3,
+                .key = run->key, .key_len = 3, .key_index = 5,
+                .in = run->in, .len = empty ? 0 : len
+            };
+            if (verify_case(run, &c) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/** Allocate the buffers of a run for inputs of up to `max_len` bytes.
+  *
+  * \return 0 on success, or -1 on failure (with `errno` set)
+  */
+static int run_init(struct verify_run *run, size_t max_len, uint64_t seed) {
+    memset(run, 0, sizeof(*run));
+    run->max_len = max_len;
+    run->state = seed;
+    run->in = malloc(max_len + 1);
+    run->key = malloc(VERIFY_MAX_KEY_LEN + 1);
+    run->expected = malloc(max_len + 1);
+    run->out = malloc(max_len + 1);
+    run->text = malloc(max_len + 1);
+    run->text_out = malloc(max_len + 1);
+    simd_set_level(SIMD_AVX512);
+    run->best = simd_level();
+    return run->in && run->key && run->expected && run->out && run->text && run->text_out
+           ? 0 : -1;
+}
+
+static void run_free(struct verify_run *run) {
+    free(run->in);
+    free(run->key);
+    free(run->expected);
+    free(run->out);
+    free(run->text);
+    free(run->text_out);
+}
+
+/** Fill `c` with a random case drawn from `*state`, using the buffers of `run`.
+  *
+  * Ranges favour the ones with specialised kernels, inputs mix mostly in-range text with
+  * arbitrary bytes and bytes next to the ends of the range or are almost all out of range,
+  * and the occasional input is long enough to be split across threads.
+  */
+static void generate_case(struct verify_run *run, uint64_t *state, struct verify_case *c) {
+    static const char fixed[][2] = { { 'A', 'Z' }, { 'a', 'z' }, { ' ', '~' }, { 0, (char) 255 } };
+
+    memset(c, 0, sizeof(*c));
+    c->op = (enum cipher_op) below(state, 4);
+    uint64_t pick = below(state, 8);
+    if (pick < 4) {
+        c->low = (uint8_t) fixed[pick][0];
+        c->high = (uint8_t) fixed[pick][1];
+    } else {
+        c->low = (uint8_t) below(state, 255);
+        c->high = (uint8_t) (c->low + 1 + below(state, 255 - c->low));
+    }
+    int size = c->high - c->low + 1;
+
+    switch (below(state, 4)) {
+    case 0:
+        c->shift = 0;
+        break;
+    case 1:
+        c->shift = size * ((int) below(state, 7) - 3) + (int) below(state, 3) - 1;
+        break;
+    case 2:
+        c->shift = (int) below(state, 2 * size + 1) - size;
+        break;
+    default:
+        c->shift = (int) below(state, 2001) - 1000;
+        break;
+    }
+
+    uint64_t r = below(state, 100);
+    c->key_len = 1 + below(state, r < 50 ? 8 : r < 85 ? 80 : VERIFY_MAX_KEY_LEN);
+    for (size_t i = 0; i < c->key_len; ++i) {
+        run->key[i] = (uint8_t) (below(state, 5) != 0 ? c->low + below(state, size)
+                                                      : 1 + below(state, 255));
+    }
+    run->key[c->key_len] = 0;
+    c->key = run->key;
+    c->key_index = below(state, 2) == 0 ? 0 : below(state, 4 * c->key_len + 3);
+
+    r = below(state, 100);
+    c->len = below(state, r < 60 ? 300 : r < 95 ? 70000 : run->max_len + 1);
+    c->len = c->len < run->max_len ? c->len : run->max_len;
+    uint8_t edges[] = {
+        (uint8_t) (c->low - 1), c->low, (uint8_t) (c->low + 1), (uint8_t) (c->high - 1),
+        c->high, (uint8_t) (c->high + 1), 0x7f, 0x80, 0xff, 1
+    };
+    int content = (int) below(state, 5);
+    for (size_t i = 0; i < c->len; ++i) {
+        uint64_t x = next_random(state);
+        switch (content) {
+        case 0:
+            run->in[i] = (uint8_t) (x % 100 < 85 ? c->low + (x >> 8) % size : 1 + (x >> 8) % 255);
+            break;
+        case 1:
+            run->in[i] = (uint8_t) (1 + x % 255);
+            break;
+        case 2:
+            run->in[i] = (uint8_t) x;
+            break;
+        case 3:
+            /* Long runs with nothing in range, for the sparse scan to skip. */
+            run->in[i] = (uint8_t) (size == 256 || x % 200 == 0 ? c->low + (x >> 8) % size
+                                    : c->high + 1 + (x >> 8) % (256 - size));
+            break;
+        default:
+            run->in[i] = edges[x % sizeof(edges)];
+            break;
+        }
+    }
+    c->in = run->in;
+}
+
+int cipher_verify_bytes(const uint8_t *data, size_t size) {
+    if (size < 6 || data[2] <= data[1]) {
+        return 0;
+    }
+    struct verify_run run;
+    if (run_init(&run, size, size) != 0) {
+        run_free(&run);
+        return 0;
+    }
+
+    struct verify_case c;
+    c.op = (enum cipher_op) (data[0] & 3);
+    c.key_index = data[0] >> 2;
+    c.low = data[1];
+    c.high = data[2];
+    c.shift = (int16_t) (data[3] << 8 | data[4]);
+    c.key_len = 1 + data[5] % 64;
+    c.key_len = c.key_len < size - 6 ? c.key_len : size - 6;
+    memcpy(run.key, data + 6, c.key_len);
+    if (c.key_len == 0) {
+        run.key[c.key_len++] = 'A';
+    }
+    run.key[c.key_len] = 0;
+    c.key = run.key;
+    c.in = data + 6 + (size > 6 ? c.key_len : 0);
+    c.len = size - (size_t) (c.in - data);
+
+    int result = verify_case(&run, &c);
+    run_free(&run);
+    return result;
+}
+
+static void verify_usage(void) {
+    fprintf(stderr,
+            "Usage: cli verify [options]\n"
+            "\n"
+            "Checks every implementation (scalar, table, each SIMD level, threaded, streamed,\n"
+            "batched, multi-range and the string functions) against a byte-at-a-time\n"
+            "reference on random cases, and that each operation's inverse restores its input.\n"
+            "\n"
+            "Options:\n"
+            "  --seed N        seed for the cases (default: the time)\n"
+            "  --iterations N  number of cases (default 1000)\n"
+            "  --max-len N     longest input (default 2097152)\n"
+            "  --case N        run only the case with this number, as printed on failure\n"
+            "  --input PATH    run the case encoded in a file, as cipher_verify_bytes does\n"
+            "  -h, --help      print this help\n");
+}
+
+/** Read the whole of the file at `path` into a new buffer.
+  *
+  * \return The buffer, or NULL on failure (with `errno` set)
+  */
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t cap = 4096;
+    uint8_t *buf = malloc(cap);
+    *len = 0;
+    while (buf != NULL) {
+        *len += fread(buf + *len, 1, cap - *len, file);
+        if (*len < cap) {
+            break;
+        }
+        uint8_t *bigger = realloc(buf, cap * 2);
+        if (bigger == NULL) {
+            free(buf);
+        }
+        buf = bigger;
+        cap *= 2;
+    }
+    int failed = buf != NULL && ferror(file);
+    int saved_errno = errno;
+    fclose(file);
+    if (failed) {
+        free(buf);
+        errno = saved_errno;
+        return NULL;
+    }
+    return buf;
+}
+
+int cli_verify(int argc, char **argv) {
+    uint64_t seed = (uint64_t) time(NULL);
+    long iterations = 1000;
+    size_t max_len = 2 << 20;
+    const char *input = NULL;
+    int single = 0;
+    uint64_t single_case = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            verify_usage();
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Option %s requires an argument.\n", arg);
+            verify_usage();
+            return 1;
+        }
+        const char *value = argv[++i];
+        char *end;
+        errno = 0;
+        unsigned long long n = strtoull(value, &end, 0);
+        int valid = *value != '\0' && *end == '\0' && errno == 0;
+        if (strcmp(arg, "--seed") == 0) {
+            seed = n;
+        } else if (strcmp(arg, "--iterations") == 0) {
+            iterations = (long) n;
+            valid = valid && n <= 1000000000;
+        } else if (strcmp(arg, "--max-len") == 0) {
+            max_len = (size_t) n;
+            valid = valid && n <= (1u << 30);
+        } else if (strcmp(arg, "--case") == 0) {
+            single = 1;
+            single_case = n;
+        } else if (strcmp(arg, "--input") == 0) {
+            input = value;
+            valid = 1;
+        } else {
+            fprintf(stderr, "Error: Unknown option %s.\n", arg);
+            verify_usage();
+            return 1;
+        }
+        if (!valid) {
+            fprintf(stderr, "Error: Invalid value for %s.\n", arg);
+            verify_usage();
+            return 1;
+        }
+    }
+
+    if (input != NULL) {
+        size_t len;
+        uint8_t *data = read_file(input, &len);
+        if (data == NULL) {
+            fprintf(stderr, "Error: Cannot read %s: %s\n", input, strerror(errno));
+            return 1;
+        }
+        int result = cipher_verify_bytes(data, len);
+        free(data);
+        if (result == 0) {
+            printf("%s: ok\n", input);
+        }
+        return result == 0 ? 0 : 1;
+    }
+
+    struct verify_run run;
+    if (run_init(&run, max_len, seed) != 0) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        run_free(&run);
+        return 1;
+    }
+
+    if (!single && verify_edge_cases(&run) != 0) {
+        fprintf(stderr, "Failed on a fixed edge case.\n");
+        run_free(&run);
+        return 1;
+    }
+
+    /* Each case is drawn from its own number, derived from the seed, so that a failing
+     * case can be rerun on its own with --case. */
+    long done = 0;
+    for (; single ? done < 1 : done < iterations; ++done) {
+        uint64_t number = single_case;
+        if (!single) {
+            uint64_t mix = seed ^ (uint64_t) done * 0xd1342543de82ef95u;
+            number = next_random(&mix);
+        }
+        uint64_t state = number;
+        run.state = number ^ 0x5851f42d4c957f2du;
+        struct verify_case c;
+        generate_case(&run, &state, &c);
+        if (verify_case(&run, &c) != 0) {
+            fprintf(stderr, "Failed on case %llu; rerun it with --case %llu --max-len %zu.\n",
+                    (unsigned long long) number, (unsigned long long) number, max_len);
+            run_free(&run);
+            return 1;
+        }
+    }
+    if (single) {
+        printf("verified case %llu (%llu comparisons)\n", (unsigned long long) single_case,
+               (unsigned long long) run.comparisons);
+    } else {
+        printf("verified %ld cases (%llu comparisons) with seed %llu\n", done,
+               (unsigned long long) run.comparisons, (unsigned long long) seed);
+    }
+    run_free(&run);
+    return 0;
+}